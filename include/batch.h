@@ -0,0 +1,8 @@
+#include <main.h>
+
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+  char *batchOptions(int argc, char **argv);
+  void batchTime(batchTimer *timer, long start);
+  void batchFinish(void);
+#endif
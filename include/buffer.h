@@ -2,6 +2,7 @@
 
 #ifndef BUFFER_H_INCLUDED
 #define BUFFER_H_INCLUDED
+  char *extendBuffer(buffer *, int length);
   void appendBuffer(buffer *, const char *string, int length);
   void freeBuffer(buffer *);
 #endif
@@ -3,6 +3,8 @@
 #ifndef EDITOR_H_INCLUDED
 #define EDITOR_H_INCLUDED
   void editorInsertChar(int c);
+  void editorInsertText(char *text, size_t length);
+  void editorPaste(void);
   void editorDeleteChar(void);
   void editorInsertNewLine(void);
 #endif
@@ -2,7 +2,8 @@
 
 #ifndef FILEIO_H_INCLUDED
 #define FILEIO_H_INCLUDED
-  char *editorLinesToString(int *buflen);
+  size_t pieceContent(linePiece *piece, char *dest);
   void editorOpen(char *filename);
+  void editorLoadFile(int fd);
   void editorSave(void);
 #endif
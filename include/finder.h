@@ -2,7 +2,12 @@
 
 #ifndef FINDER_H_INCLUDED
 #define FINDER_H_INCLUDED
-  char *findLastOccurrence(char *lasMatch, char *query, char *lineContent);
+  int findOriginalLineFrom(int line, int end, size_t offset);
+  char *findNextIn(findQuery *query, char *text, size_t length, bool isLineStart, int *matchLength);
+  bool findForward(findQuery *query, int row, int col, int to, findMatch *found);
+  const char *findQueryCompile(findQuery *query);
+  bool findPosition(int *current, int *total);
   bool editorFindCallback(char *query, int key);
   void editorFind(void);
+  void editorFindRegex(void);
 #endif
@@ -0,0 +1,25 @@
+#include <main.h>
+
+#ifndef GAP_H_INCLUDED
+#define GAP_H_INCLUDED
+  void gapMove(int at);
+  editorLine *gapOpen(int row);
+  char gapChar(int cx);
+  int gapLookahead(void);
+  gapCheckpoint *gapAppend(gapCheckpoint **list, int *count, int *capacity);
+  void gapResetCheckpoints(bool inComment);
+  int gapCheckpointsUpTo(int column, bool onScreen);
+  int gapAdvance(int from, int rx, int to);
+  void gapRenderSpan(int from, int rx, int to);
+  bool gapSameState(highlightController *a, highlightController *b);
+  bool gapResync(int *stale, int cx, highlightController *hc);
+  void gapWalk(int cx, int rx, bool toEnd);
+  void gapForget(int at, bool isDelete);
+  int gapCxToRx(int cx);
+  void gapRender(void);
+  bool gapHighlight(bool inComment);
+  void gapCopy(char *dest);
+  void gapClose(void);
+  void gapInsertChar(int row, int at, int c);
+  void gapDeleteChar(int row, int at);
+#endif
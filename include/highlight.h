@@ -2,15 +2,26 @@
 
 #ifndef HIGHLIGHT_H_INCLUDED
 #define HIGHLIGHT_H_INCLUDED
-  void colorLine(editorLine *line, int start, color_t, int len);
+  void colorLine(editorLine *line, int start, unsigned char token, int len);
   bool highlightSinglelineComments(editorLine *line, highlightController *);
   bool highlightMultilineComments(editorLine *line, highlightController *);
   bool highlightStrings(editorLine *line, highlightController *);
   bool highlightNumbers(editorLine *line, highlightController *);
   bool highlightKeywords(editorLine *line, highlightController *);
   bool highlightOperators(editorLine *line, highlightController *);
-  bool highlightSymbols(editorLine *line, highlightController *, char **symbols, color_t);
+  bool highlightSymbols(editorLine *line, highlightController *, int class, unsigned char token);
+  syntaxKeyword *highlightFindKeyword(syntaxTables *, char *token, int length);
+  void highlightCompileSyntax(editorSyntax *);
+  void highlightRun(editorLine *line, highlightController *hc, int end);
+  bool editorHighlightLine(editorLine *line, bool inComment);
+  bool highlightLineFor(editorLine *line, bool inComment);
   void editorUpdateHighlight(editorLine *line);
+  void highlightInvalidate(int at);
+  void highlightCheckpoint(int at, bool inComment);
+  bool highlightTextState(char *content, int length, bool inComment, editorLine *scratch);
+  void highlightFreeScratch(void);
+  void highlightPlain(editorLine *line);
+  void editorHighlightRows(int first, int last);
   void editorSelectSyntaxHighlight(void);
   void clearSearchHighlight(void);
 #endif
@@ -0,0 +1,10 @@
+#include <main.h>
+
+#ifndef HIGHLIGHTER_H_INCLUDED
+#define HIGHLIGHTER_H_INCLUDED
+  void highlighterStart(void);
+  void highlighterPost(int from, int to);
+  void highlighterCancel(void);
+  void highlighterAdopt(void);
+  void editorHighlightViewport(void);
+#endif
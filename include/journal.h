@@ -0,0 +1,11 @@
+#include <main.h>
+
+#ifndef JOURNAL_H_INCLUDED
+#define JOURNAL_H_INCLUDED
+  void journalStart(void);
+  void journalAppend(int kind, int row, int col, int count, const char *text, size_t length);
+  void journalOpen(void);
+  void journalDiscard(void);
+  size_t journalMark(void);
+  void journalRebase(size_t mark);
+#endif
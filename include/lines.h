@@ -2,16 +2,34 @@
 
 #ifndef LINES_H_INCLUDED
 #define LINES_H_INCLUDED
+  editorLine *editorGetLine(int at);
+  editorLine *editorPeekLine(int at);
+  editorLine *editorViewLine(int at);
+  int editorLineLength(int at);
+  char *editorLineContent(int at, int *length);
+  void editorLoadLines(char *content, size_t length, bool isMapped);
+  void editorLoadIndexedLines(void);
   int indentation(editorLine *line);
   int editorLineCxToRx(editorLine *line, int cursorX);
+  int editorRowCxToRx(int at, int cx);
   int editorLineRxToCx(editorLine *line, int rCursorX);
+  int editorCountTabs(editorLine *);
   void editorUpdateLine(editorLine *);
+  void editorDropRender(editorLine *);
+  void editorRenderLine(editorLine *, int tabs);
+  void editorRenderParts(editorLine *, char *head, int split, char *tail, int tabs);
   void editorInsertLine(int at, char *line, size_t length);
+  int editorInsertLines(int at, char *text, size_t length);
+  void editorInsertOriginalLines(int at, int first, int count);
   void editorFreeLine(editorLine *line);
   void editorDeleteLine(int at);
+  void editorDeleteLines(int at, int count);
   void editorLineInsertChar(editorLine *line, int at, int c);
+  void editorLineInsertString(editorLine *line, int at, char *string, size_t len);
   void editorLineAppendString(editorLine *line, char *string, size_t len);
   void editorLineDeleteChar(editorLine *line, int at);
+  void editorLineDeleteString(editorLine *line, int at, size_t len);
+  void editorLineReplaceString(editorLine *line, char *string, size_t len);
   void deleteToEndOFLine(int at);
   void deleteLineContent(int at);
   void changeEntireLine(int at);
@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,11 +7,17 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #ifndef MAIN_H_INCLUDED
 #define MAIN_H_INCLUDED
@@ -21,11 +28,46 @@
   #endif
 
   #define CTRL_KEY(k) ((k) & 0x1f)
-  #define BUFFER_INIT {NULL, 0}
+  #define BUFFER_INIT {NULL, 0, 0}
   #define KILO_VERSION "0.4.2"
   #define TAB_SIZE 2
   #define QUIT_TIMES 2
   #define MIN_SIDEBAR_WIDTH 6
+  #define ADDED_BLOCK_SIZE 1024
+  #define BACKGROUND_INDEX_SIZE (1 << 20)
+  #define MAX_LINE_TABS 255
+  #define HIGHLIGHT_CHECKPOINT_INTERVAL 64
+  #define HIGHLIGHT_LOOKAHEAD 16
+  #define HIGHLIGHT_SYNC_LINES 256
+  #define SCREEN_SPAN_GAP 8
+  #define COLOR_CACHE_SIZE 64
+  #define INPUT_BUFFER_SIZE 4096
+  #define ESCAPE_TIMEOUT 10
+  #define FRAME_INTERVAL 16
+  #define LINE_GAP_SIZE 64
+  #define GAP_CHECKPOINT_INTERVAL 4096
+  #define SLAB_CHUNK_SIZE (64 * 1024)
+  #define SLAB_MIN_BLOCK 16
+  #define SLAB_CLASSES 16
+  // Bytes the undo log keeps, which can be given when building as with
+  // -DUNDO_MEMORY_LIMIT=...; the group being made is kept even past it
+  #ifndef UNDO_MEMORY_LIMIT
+    #define UNDO_MEMORY_LIMIT (16 << 20)
+  #endif
+  #define JOURNAL_SYNC_INTERVAL 1000
+  #define JOURNAL_SUFFIX ".journal"
+  #define SAVE_BATCH_SIZE 1024
+  #define REGEXP_MAX_LENGTH 1024
+  #define REGEXP_MAX_STATES 65536
+  #define REGEXP_MAX_REPEAT 255
+  #define REGEXP_DFA_STATES 1024
+  #define REGEXP_MAX_STOPS 3
+  #define FIND_INDEX_LIMIT (1 << 16)
+  #define SEARCH_CHUNK_LINES 16384
+  #define SEARCH_WINDOW_BYTES (64 << 10)
+  #define SEARCH_MAX_THREADS 8
+  #define BATCH_ROWS 24
+  #define BATCH_COLS 80
   #define RETURN '\r'
   #define SPACE ' '
   #define ESC '\x1b'
@@ -37,6 +79,12 @@
   #define HIGHLIGHT_NUMBERS (1 << 0)
   #define HIGHLIGHT_STRINGS (1 << 1)
 
+  // Character classes
+  #define CLASS_SEPARATOR (1 << 0)
+  #define CLASS_OPERATOR (1 << 1)
+  #define CLASS_BRACKET (1 << 2)
+  #define CLASS_END_STATEMENT (1 << 3)
+
   enum editorKeys {
     BACKSPACE = 127,
     ARROW_UP = 1000,
@@ -47,7 +95,9 @@
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN
+    PAGE_DOWN,
+    PASTE_START,
+    PASTE_END
   };
 
   enum editorModes {
@@ -55,6 +105,52 @@
     INSERT
   };
 
+  // Changes kept in the undo log: text put in or taken out of a line, and
+  // whole lines inserted or deleted
+  enum undoKinds {
+    UNDO_INSERT_TEXT,
+    UNDO_DELETE_TEXT,
+    UNDO_INSERT_LINES,
+    UNDO_DELETE_LINES
+  };
+
+  // Entries of the journal other than changes
+  enum journalMarks {
+    JOURNAL_UNDO = 16,
+    JOURNAL_REDO
+  };
+
+  // Nodes of a parsed regular expression, and states of the NFA it is
+  // compiled to, which only uses sets, line assertions, splits and match
+  enum regexpKinds {
+    REGEXP_EMPTY,
+    REGEXP_SET,
+    REGEXP_LINE_START,
+    REGEXP_LINE_END,
+    REGEXP_CONCAT,
+    REGEXP_ALTERNATE,
+    REGEXP_REPEAT,
+    REGEXP_SPLIT,
+    REGEXP_MATCH
+  };
+
+  // What every rendered character is, looked up in the palette when drawn
+  enum highlightTokens {
+    TOKEN_TEXT,
+    TOKEN_KEYWORD,
+    TOKEN_DATATYPE,
+    TOKEN_PREPROCESSOR,
+    TOKEN_NUMBER,
+    TOKEN_STRING,
+    TOKEN_COMMENT,
+    TOKEN_OPERATOR,
+    TOKEN_BRACKET,
+    TOKEN_END_STATEMENT,
+    TOKEN_MATCH,
+    TOKEN_SELECTED_MATCH,
+    TOKEN_COUNT
+  };
+
   typedef struct {
     unsigned char r;
     unsigned char g;
@@ -107,6 +203,23 @@
     int length;
   };
 
+  typedef struct {
+    char *value;
+    int length;
+    unsigned char token;
+    bool isInclude;
+  } syntaxKeyword;
+
+  // Lookup tables built from a syntax entry by initHighlightDataBase: the
+  // class of every byte, and the keywords in a collision free hash table
+  typedef struct {
+    unsigned char classes[256];
+    syntaxKeyword *keywords;
+    unsigned int size;
+    unsigned int seed;
+    int maxLength;
+  } syntaxTables;
+
   typedef struct {
     char **filematch;
     char **keywords;
@@ -122,6 +235,8 @@
         struct comment end;
       } multiline;
     } comment;
+
+    syntaxTables *tables;
   } editorSyntax;
 
   typedef struct {
@@ -129,22 +244,361 @@
     bool inComment;
     int inString;
     int idx;
-    color_t prevHL;
+    unsigned char prevHL;
+    unsigned char rest;
   } highlightController;
 
+  // Where a tab is in the content of a line and where it starts on screen
+  typedef struct {
+    int cx, rx;
+  } tabStop;
+
+  // Where the highlighter stands at column 'cx' of the line being typed
+  // into, which is at column 'rx' on screen
+  typedef struct {
+    int cx, rx;
+    highlightController state;
+  } gapCheckpoint;
+
+  // Lines without tabs render as they are, with renderContent pointing to
+  // their content, unless they have a render of their own. The line being
+  // typed into only renders what is around the screen, from 'renderStart'
   typedef struct {
     int index;
     char *content, *renderContent;
     int length, renderLength;
+    int renderStart;
+    tabStop *tabStops;
+    int numtabs;
+    bool hasOwnRender;
+    bool startsInComment;
     bool isOpenComment;
-    color_t *highlight;
+    bool isHighlighted;
+    unsigned char *highlight;
   } editorLine;
 
   typedef struct {
     char *content;
     int length;
+    int capacity;
   } buffer;
 
+  // One change at 'row' and 'col', whose text holds the lines it inserted
+  // or deleted separated by line feeds; the first change of a group keeps
+  // where the cursor was before it, as a group is undone all at once.
+  // Lines deleted straight from the original file keep no text, only the
+  // first of them there in 'original', which is -1 otherwise
+  typedef struct {
+    unsigned char kind;
+    bool startsGroup;
+    int row, col;
+    int count;
+    int original;
+    int cursorX, cursorY;
+    char *text;
+    size_t length, capacity;
+  } undoRecord;
+
+  // Starts a journal, telling which version of the file its changes apply to
+  typedef struct {
+    char magic[8];
+    int64_t size;
+    int64_t mtime, mtimeNsec;
+  } journalHeader;
+
+  // A change as written to the journal, followed by its text
+  typedef struct {
+    int32_t row, col, count;
+    int32_t cursorX, cursorY;
+    uint32_t length;
+    uint8_t kind;
+    uint8_t isBroken;
+    uint8_t padding[2];
+  } journalEntry;
+
+  // Escape sequence that selects a color, encoded once
+  typedef struct {
+    uint32_t key;
+    char sequence[24];
+    int length;
+  } colorSequence;
+
+  typedef struct {
+    char ch;
+    bool isBold;
+    color_t fg;
+    color_t bg;
+  } screenCell;
+
+  // Precedes every block of line storage
+  typedef struct {
+    uint32_t size;
+    uint32_t sizeClass;
+  } slabHeader;
+
+  // Buffers too big for a class are kept in a list to be released together
+  typedef struct slabLarge {
+    struct slabLarge *prev, *next;
+    size_t size;
+  } slabLarge;
+
+  typedef struct {
+    void *freed;
+    char *next, *end;
+  } slabClass;
+
+  // Free blocks and the bytes in use, for the editor thread or for all
+  // the others
+  typedef struct {
+    slabClass classes[SLAB_CLASSES];
+    size_t liveBytes, usedBytes;
+  } slabCache;
+
+  // A run of 'count' newline separated lines handed to the highlighter thread
+  typedef struct {
+    char *content;
+    size_t length;
+    int count;
+    bool isCopy;
+  } highlightSegment;
+
+  // Lines [first, to) as they were when the job was posted, of which
+  // [from, to) get colored and the rest only carry the comment state along
+  typedef struct {
+    unsigned int generation;
+    int first;
+    bool inComment;
+    int from, to;
+    highlightSegment *segments;
+    int numsegments;
+  } highlightJob;
+
+  typedef struct {
+    unsigned char *highlight;
+    int renderLength;
+    bool startsInComment;
+    bool isOpenComment;
+  } highlightedLine;
+
+  typedef struct {
+    unsigned int generation;
+    int first;
+    bool *checkpoints;
+    int numcheckpoints;
+    int from, to;
+    highlightedLine *lines;
+  } highlightResult;
+
+  // Start of every line of a text, stored as its low 32 bits plus the lines
+  // at which the high bits grow, so that offsets take 4 bytes per line
+  typedef struct {
+    uint32_t *offsets;
+    unsigned char *tabs;
+    int *wraps;
+    int numwraps;
+    int numlines;
+    int capacity;
+    int crlf;
+  } lineIndex;
+
+  // A search query with the skips of the scan in either direction for every
+  // byte that can be under the far end of the window
+  typedef struct {
+    char *query;
+    size_t length;
+    size_t forward[256];
+    size_t backward[256];
+  } matchPattern;
+
+  typedef struct {
+    uint32_t bits[8];
+  } regexpSet;
+
+  // Repeats take 'min' to 'max' copies of 'left', with -1 for no maximum
+  typedef struct {
+    int kind;
+    int left, right;
+    int set;
+    int min, max;
+  } regexpNode;
+
+  // Sets go on to 'next' on a byte they hold, assertions without one, and
+  // splits to both 'next' and 'alternate'
+  typedef struct {
+    int kind;
+    int set;
+    int next, alternate;
+  } regexpState;
+
+  typedef struct {
+    regexpState *states;
+    int count, capacity;
+    int start, match;
+  } regexpNfa;
+
+  // A DFA state: the NFA states it stands for, sorted, and where every byte
+  // leads from it, -1 until that is first needed
+  typedef struct {
+    int *states;
+    int count;
+    unsigned int hash;
+    int next[256];
+    bool isMatch;
+    bool isMatchAtEnd;
+  } regexpDfaState;
+
+  // A DFA made from an NFA as a scan goes, either anchored where the scan
+  // starts or looking for a match anywhere past it. Its states are thrown
+  // away when there are REGEXP_DFA_STATES of them. 'stops' are the bytes
+  // that take it out of its start state, when there are few enough
+  typedef struct {
+    regexpNfa *nfa;
+    regexpSet *sets;
+    bool isUnanchored;
+    regexpDfaState *states;
+    int numstates, capacity;
+    int *table;
+    int starts[2];
+    int numstops;
+    unsigned char stops[REGEXP_MAX_STOPS];
+    unsigned int flushes;
+    unsigned int *marks;
+    unsigned int generation;
+    int *stack, *moved, *closure;
+  } regexpDfa;
+
+  // A regular expression compiled for both directions, with a DFA to find
+  // the first line with a match, one to walk back to its start and one to
+  // follow it to its end
+  typedef struct {
+    regexpSet *sets;
+    int numsets;
+    regexpNfa forward, reverse;
+    regexpDfa search, backward, longest;
+  } regexpProgram;
+
+  typedef struct {
+    char *at;
+    regexpNode *nodes;
+    int numnodes, capacity;
+    regexpProgram *program;
+    const char *error;
+  } regexpParser;
+
+  // What the search prompt looks for, compiled once for all the keys that
+  // move between its matches
+  typedef struct {
+    char *source;
+    bool isRegex;
+    matchPattern pattern;
+    regexpProgram regex;
+    const char *error;
+  } findQuery;
+
+  typedef struct {
+    int row, col;
+    int length;
+  } findMatch;
+
+  // A substitution read from the command prompt, over rows [first, last]
+  typedef struct {
+    int first, last;
+    findQuery query;
+    char *replacement;
+    bool isGlobal;
+  } replaceCommand;
+
+  // Every match of the query in the buffer, in order, as long as there are
+  // no more than FIND_INDEX_LIMIT of them, and how many there are in all,
+  // as of 'changes'. A literal query keeps it while it grows since a longer
+  // query only matches where a shorter one did
+  typedef struct {
+    findMatch *matches;
+    int count, capacity;
+    bool isComplete;
+    int total;
+    bool isCounted;
+    unsigned long changes;
+  } findIndex;
+
+  // A run of consecutive lines taken either from the original file or from
+  // the added lines store, kept in a treap ordered by line number
+  typedef struct linePiece {
+    bool isOriginal;
+    int start;
+    int count;
+    int total;
+    unsigned int priority;
+    struct linePiece *left, *right;
+  } linePiece;
+
+  // A run of lines a search worker takes on in one go: lines of the
+  // original file as they lie in the mapping, or a copy of added lines
+  // separated by newlines. The matches found are kept until there are too
+  // many of them across the chunks, but all of them are counted
+  typedef struct {
+    int row;
+    linePiece piece;
+    char *text;
+    size_t length;
+    findMatch *matches;
+    int nummatches, capacity;
+    int total;
+    int kept;
+    bool isKeeping;
+  } searchChunk;
+
+  // A search of the whole buffer shared out among the worker threads, which
+  // take on its chunks in turn from 'next'
+  typedef struct {
+    unsigned int generation;
+    char *source;
+    bool isRegex;
+    searchChunk *chunks;
+    int numchunks;
+    int next, done;
+    int kept;
+  } searchJob;
+
+  // A run of lines as they were when a save started: lines of the original
+  // file are written from where they are, the others were copied to 'text'
+  typedef struct {
+    linePiece piece;
+    char *text;
+    size_t length;
+  } saveSegment;
+
+  // How many times something was timed in a batch run, in microseconds
+  typedef struct {
+    int count;
+    long total, slowest;
+  } batchTimer;
+
+  // A snapshot of the buffer handed to the saver thread, which fills in the
+  // descriptor of the saved file, or -1 and the error
+  typedef struct {
+    char *path;
+    saveSegment *segments;
+    int numsegments;
+    char *eol;
+    unsigned long changes;
+    size_t journalMark;
+    size_t total, written;
+    long start;
+    int fd, error;
+  } saveJob;
+
+  // Buffers gathered to be written to the saved file with a single writev
+  typedef struct {
+    int fd;
+    struct iovec iov[SAVE_BATCH_SIZE];
+    int count;
+    saveJob *job;
+    int percent;
+    size_t written;
+    bool isFailed;
+  } saveBatch;
+
   typedef struct {
     int cursorX, cursorY;
     int savedLastY;
@@ -157,9 +611,177 @@
     int sidebarWidth;
     int mode;
     bool dirty;
+    unsigned long changes;
     bool splashScreen;
     bool isPromptOpen;
-    editorLine *lines;
+    bool isPrompting;
+    bool isMessageShown;
+    linePiece *pieces;
+    struct {
+      char *content;
+      size_t length;
+      size_t indexed;
+      lineIndex index;
+      bool isMapped;
+      struct {
+        pthread_t thread;
+        bool isRunning;
+        lineIndex index;
+      } indexer;
+    } original;
+    struct {
+      editorLine **blocks;
+      int numblocks;
+      int size;
+      int *freed;
+      int numfreed;
+    } added;
+    // Comment state at the start of every HIGHLIGHT_CHECKPOINT_INTERVAL
+    // lines, valid for the first 'count' of them
+    struct {
+      bool *states;
+      int count;
+      int capacity;
+    } checkpoints;
+    struct {
+      pthread_t thread;
+      bool isRunning;
+      bool isBusy;
+      pthread_mutex_t lock;
+      pthread_cond_t wake;
+      pthread_cond_t idle;
+      highlightJob *job;
+      highlightResult *result;
+      unsigned int generation;
+      struct {
+        unsigned int generation;
+        int from, to;
+      } posted;
+    } highlighter;
+    // What the terminal shows (front) and the frame being drawn (back)
+    struct {
+      screenCell *front, *back;
+      int rows, cols;
+      int row, col;
+      color_t fg, bg;
+      bool isBold;
+      bool isValid;
+      buffer output;
+      struct {
+        color_t fg, bg;
+        bool isBold;
+        bool hasFg, hasBg;
+      } pen;
+    } screen;
+    // The line being typed into, whose content has a gap [start, end) at
+    // the cursor out of 'capacity' bytes, and whether its render is up to
+    // date with it for the columns it was rendered for. Checkpoints say
+    // where the highlighter stands along it when it starts in
+    // 'startsInComment'; the ones past the last change are kept as stale,
+    // by their distance from the end, as the line still ends in 'staleEnd'
+    // if the highlighter gets to one of them the same way
+    struct {
+      editorLine *line;
+      int row;
+      int start, end;
+      int capacity;
+      bool isRendered;
+      int renderedOffset, renderedWidth;
+      bool startsInComment;
+      bool isEndKnown, endsInComment;
+      gapCheckpoint *checkpoints;
+      int numcheckpoints, checkpointsCapacity;
+      gapCheckpoint *stale;
+      int numstale, staleCapacity;
+      bool staleEnd;
+      editorLine scratch;
+      int *columns;
+    } gap;
+    // Where the content, render and colors of every line live. The thread
+    // that set it up has a cache of its own, while other threads share the
+    // other one under the lock, which also guards the chunks and the large
+    // buffers
+    struct {
+      pthread_mutex_t lock;
+      slabCache own, shared;
+      char **chunks;
+      int numchunks;
+      slabLarge *large;
+      size_t largeBytes;
+    } slab;
+    // Changes made to the text, of which the first 'done' can be undone
+    // and the rest redone, along with the memory their text takes, where
+    // the group being made starts and how many were done when the file was
+    // last saved, or -1 once undoing and redoing cannot get back there
+    struct {
+      undoRecord *records;
+      int count, done, capacity;
+      int saved;
+      size_t bytes;
+      int group;
+      bool isBroken;
+      bool isSuspended;
+      int cursorX, cursorY;
+    } undo;
+    // Changes made since the file was last saved, piled up in 'pending'
+    // until the journal thread writes them out
+    struct {
+      char *path;
+      int fd;
+      buffer pending;
+      size_t size;
+      pthread_t thread;
+      pthread_mutex_t lock;
+      pthread_cond_t idle;
+      bool isRunning;
+      bool isBusy;
+    } journal;
+    // The save being written by the saver thread, if any, taken back by the
+    // editor once it is 'finished', and the file mode creation mask new
+    // files are made with
+    struct {
+      pthread_t thread;
+      bool isRunning;
+      bool isBusy;
+      pthread_mutex_t lock;
+      pthread_cond_t wake;
+      pthread_cond_t idle;
+      saveJob *job;
+      saveJob *current;
+      saveJob *finished;
+      mode_t umask;
+    } saver;
+    struct {
+      pthread_t threads[SEARCH_MAX_THREADS];
+      int numthreads;
+      bool isRunning;
+      int busy;
+      pthread_mutex_t lock;
+      pthread_cond_t wake;
+      pthread_cond_t idle;
+      searchJob *job;
+      unsigned int generation;
+    } searcher;
+    findQuery find;
+    findIndex matches;
+    // Keys read from the terminal but not handled yet
+    struct {
+      char bytes[INPUT_BUFFER_SIZE];
+      int start, end;
+      int fd;
+    } input;
+    // A run without a terminal, whose keys come from a script and whose
+    // screen is only drawn in memory, timing what the editor does
+    struct {
+      bool isRunning;
+      int fd;
+      int rows, cols;
+      char *output;
+      long start;
+      batchTimer load, keys, frames;
+      size_t written;
+    } batch;
+    int wakeup[2];
     char *filename;
     char statusmsg[80];
     editorSyntax *syntax;
@@ -168,6 +790,8 @@
 
   extern editorConfig E; 
   extern colors theme; 
+  extern color_t *palette[TOKEN_COUNT];
+  extern colorSequence colorCache[COLOR_CACHE_SIZE];
 
   /*** Filetypes ***/
   extern char *C_EXTENSIONS[];
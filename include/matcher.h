@@ -0,0 +1,8 @@
+#include <main.h>
+
+#ifndef MATCHER_H_INCLUDED
+#define MATCHER_H_INCLUDED
+  void matcherCompile(matchPattern *, char *query, size_t length);
+  char *matcherNext(matchPattern *, char *text, size_t length);
+  char *matcherPrevious(matchPattern *, char *text, size_t length);
+#endif
@@ -3,19 +3,20 @@
 #ifndef OUTPUT_H_INCLUDED
 #define OUTPUT_H_INCLUDED
   void editorRefreshScreen(void);
+  void editorRepaintScreen(void);
   void editorScrollX(void);
   void editorScrollY(void);
-  void editorDrawLines(buffer *);
-  void editorDrawStatusBar(buffer *);
-  void editorDrawPromptBar(buffer *);
-  void editorSetCursorPosition(buffer *);
+  void editorDrawLines(void);
+  void editorDrawStatusBar(void);
+  void editorDrawPromptBar(void);
 
   void editorSetStatusMessage(const char *format, ...);
+  colorSequence *colorSequenceFor(color_t color);
   void editorHighlightOutput(buffer *, color_t color);
-  void setDefaultColors(buffer *);
-  void printLineNumber(int row, buffer *);
-  void printTextLine(int row, color_t background, buffer *);
-  void printSplashScreen(buffer *);
+  void setDefaultColors(void);
+  void printLineNumber(int row);
+  void printTextLine(int row, color_t background);
+  void printSplashScreen(void);
   void adjustSidebarWidth(void);
   void fixCursorXPosition(void);
   void moveCursorToLine(long lineNumber);
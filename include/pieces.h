@@ -0,0 +1,21 @@
+#include <main.h>
+
+#ifndef PIECES_H_INCLUDED
+#define PIECES_H_INCLUDED
+  linePiece *piecesFind(int at, int *offset);
+  void piecesInsert(int at, bool isOriginal, int start, int count);
+  void piecesRemove(int at, int count, bool freeLines);
+  void piecesTraverse(void (*visit)(linePiece *, void *), void *arg);
+  void piecesFree(void);
+  int addedAlloc(void);
+  int addedAllocRun(int count);
+  editorLine *addedLine(int slot);
+  void addedRelease(int slot);
+  void originalScan(lineIndex *, size_t from, size_t end);
+  void originalLoad(char *content, size_t length, bool isMapped);
+  int originalIndexFinish(void);
+  bool originalIsCRLF(void);
+  int originalLineTabs(int line);
+  char *originalLinesContent(int line, int count, size_t *length);
+  char *originalLineContent(int line, int *length);
+#endif
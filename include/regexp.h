@@ -0,0 +1,9 @@
+#include <main.h>
+
+#ifndef REGEXP_H_INCLUDED
+#define REGEXP_H_INCLUDED
+  const char *regexpCompile(regexpProgram *, char *source);
+  void regexpFree(regexpProgram *);
+  char *regexpNext(regexpProgram *, char *text, size_t length, bool isLineStart, size_t *matchLength);
+  char *regexpPrevious(regexpProgram *, char *text, size_t length, size_t limit, size_t *matchLength);
+#endif
@@ -0,0 +1,6 @@
+#include <main.h>
+
+#ifndef REPLACER_H_INCLUDED
+#define REPLACER_H_INCLUDED
+  void editorReplace(void);
+#endif
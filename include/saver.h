@@ -0,0 +1,11 @@
+#include <main.h>
+
+#ifndef SAVER_H_INCLUDED
+#define SAVER_H_INCLUDED
+  void saverStart(void);
+  void saverPost(char *path);
+  void saverWait(void);
+  int saverWrite(char *path);
+  bool saverFinish(void);
+  bool saverProgress(int *percent);
+#endif
@@ -0,0 +1,10 @@
+#include <main.h>
+
+#ifndef SCANNER_H_INCLUDED
+#define SCANNER_H_INCLUDED
+  void lineIndexPush(lineIndex *, size_t offset);
+  size_t lineIndexOffset(lineIndex *, int line);
+  void lineIndexAppend(lineIndex *dest, lineIndex *src);
+  void lineIndexFree(lineIndex *);
+  void scanLines(lineIndex *, const char *content, size_t from, size_t to, size_t end);
+#endif
@@ -0,0 +1,12 @@
+#include <main.h>
+
+#ifndef SCREEN_H_INCLUDED
+#define SCREEN_H_INCLUDED
+  void screenBegin(void);
+  void screenWrite(const char *text, int length);
+  void screenSetColor(color_t color);
+  void screenSetBold(bool isBold);
+  void screenEraseLine(void);
+  void screenNewline(void);
+  void screenFlush(int cursorRow, int cursorCol);
+#endif
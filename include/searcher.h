@@ -0,0 +1,9 @@
+#include <main.h>
+
+#ifndef SEARCHER_H_INCLUDED
+#define SEARCHER_H_INCLUDED
+  void searcherStart(void);
+  void searcherPost(findQuery *query);
+  void searcherCancel(void);
+  bool searcherFinish(void);
+#endif
@@ -0,0 +1,11 @@
+#include <main.h>
+
+#ifndef SLAB_H_INCLUDED
+#define SLAB_H_INCLUDED
+  void slabInit(void);
+  void *slabAlloc(size_t size);
+  void *slabRealloc(void *block, size_t size);
+  void slabFree(void *block);
+  void slabRelease(void);
+  void slabShowStats(void);
+#endif
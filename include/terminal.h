@@ -5,7 +5,16 @@
   void enableRawMode(void);
   void disableRawMode(void);
   void die(const char *str);
+  void terminalWrite(const char *content, size_t length);
+  bool editorWaitForInput(int timeout);
+  void editorHandleEvents(void);
+  bool editorNextByte(char *c, int timeout);
+  bool editorInputPending(void);
   int editorReadKey(void);
+  char *editorReadPaste(size_t *length);
   bool getCursorPosition(int *rows, int *cols);
   bool getWindowSize(int *rows, int *cols);
+  bool editorUpdateWindowSize(void);
+  void handleWindowResize(int signal);
+  void watchWindowSize(void);
 #endif
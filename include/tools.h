@@ -10,4 +10,6 @@
   bool isSpecial(int c);
   bool colorcmp(color_t, color_t);
   bool isDark(int r, int g, int b);
+  long currentMilliseconds(void);
+  long currentMicroseconds(void);
 #endif
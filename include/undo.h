@@ -0,0 +1,14 @@
+#include <main.h>
+
+#ifndef UNDO_H_INCLUDED
+#define UNDO_H_INCLUDED
+  void undoInit(void);
+  void undoClear(void);
+  void undoBreak(void);
+  void undoPush(int kind, int row, int col, int count, const char *text, size_t length);
+  void undoDeleteLines(int at, int count);
+  void undoLoadOriginal(void);
+  void undoApply(undoRecord *record, bool isUndo);
+  void editorUndo(void);
+  void editorRedo(void);
+#endif
@@ -0,0 +1,115 @@
+#define _DEFAULT_SOURCE
+
+#include <batch.h>
+#include <lines.h>
+#include <output.h>
+#include <saver.h>
+#include <tools.h>
+
+// A batch run reads its keys from a script, byte for byte as a terminal
+// would have sent them, so recorded sessions can be played back as they
+// were typed. Frames are drawn into the screen kept in memory as usual,
+// and the escape sequences that would have brought the terminal up to
+// date are only counted. Once the script is over, or the editor is quit,
+// the buffer is written out and the times taken go to the standard error
+
+void batchUsage(char *name) {
+  fprintf(stderr, "Usage: %s [-b script [-s ROWSxCOLS] [-o output]] [file]\n", name);
+  exit(1);
+}
+
+// Reads the command line, returning the file to open if there is one
+char *batchOptions(int argc, char **argv) {
+  char *script = NULL;
+  int option;
+
+  E.batch.start = currentMicroseconds();
+  E.batch.rows = BATCH_ROWS;
+  E.batch.cols = BATCH_COLS;
+  E.batch.output = NULL;
+
+  while ((option = getopt(argc, argv, "b:s:o:")) != -1) {
+    switch (option) {
+      case 'b':
+        script = optarg;
+        break;
+
+      // The last row is the status bar, so at least one more is needed
+      case 's':
+        if (sscanf(optarg, "%dx%d", &E.batch.rows, &E.batch.cols) != 2 || E.batch.rows < 2 || E.batch.cols < 1)
+          batchUsage(argv[0]);
+        break;
+
+      case 'o':
+        E.batch.output = optarg;
+        break;
+
+      default:
+        batchUsage(argv[0]);
+    }
+  }
+
+  if (optind + 1 < argc)
+    batchUsage(argv[0]);
+
+  if (script) {
+    E.batch.fd = strcmp(script, "-") ? open(script, O_RDONLY) : STDIN_FILENO;
+    if (E.batch.fd == -1) {
+      perror(script);
+      exit(1);
+    }
+    E.batch.isRunning = true;
+  }
+  else if (E.batch.output || E.batch.rows != BATCH_ROWS || E.batch.cols != BATCH_COLS) {
+    batchUsage(argv[0]);
+  }
+
+  return optind < argc ? argv[optind] : NULL;
+}
+
+// Adds the time since 'start' to a timer
+void batchTime(batchTimer *timer, long start) {
+  long elapsed = currentMicroseconds() - start;
+
+  timer->count++;
+  timer->total += elapsed;
+  if (elapsed > timer->slowest)
+    timer->slowest = elapsed;
+}
+
+void batchReport(char *name, batchTimer *timer) {
+  fprintf(stderr, "%-8s %10.3f ms  %8d times, slowest %.3f ms\n",
+    name, timer->total / 1000.0, timer->count, timer->slowest / 1000.0);
+}
+
+// Ends a batch run, drawing the last frame and writing the buffer to the
+// output given, if any
+void batchFinish(void) {
+  long start = currentMicroseconds();
+  editorRefreshScreen();
+  batchTime(&E.batch.frames, start);
+
+  saverWait();
+
+  batchTimer save = {0, 0, 0};
+  int error = 0;
+
+  if (E.batch.output) {
+    start = currentMicroseconds();
+    editorLoadIndexedLines();
+    error = saverWrite(strdup(E.batch.output));
+    batchTime(&save, start);
+  }
+
+  batchReport("load", &E.batch.load);
+  batchReport("keys", &E.batch.keys);
+  batchReport("frames", &E.batch.frames);
+  if (E.batch.output)
+    batchReport("save", &save);
+  fprintf(stderr, "%-8s %10.3f ms\n", "total", (currentMicroseconds() - E.batch.start) / 1000.0);
+  fprintf(stderr, "%-8s %10zu bytes\n", "output", E.batch.written);
+
+  if (error)
+    fprintf(stderr, "Can't write %s: %s\n", E.batch.output, strerror(error));
+  exit(error ? 1 : 0);
+}
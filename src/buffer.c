@@ -1,17 +1,36 @@
 #include <buffer.h>
 
+// Makes room for 'length' more bytes and returns where they go; the
+// capacity doubles so that appending is amortized constant time
+char *extendBuffer(buffer *buff, int length) {
+  if (buff->length + length > buff->capacity) {
+    int capacity = buff->capacity ? buff->capacity : 1024;
+    while (capacity < buff->length + length)
+      capacity *= 2;
+
+    char *new = realloc(buff->content, capacity);
+
+    if (new == NULL)
+      return NULL;
+
+    buff->content = new;
+    buff->capacity = capacity;
+  }
+
+  char *end = &buff->content[buff->length];
+  buff->length += length;
+  return end;
+}
+
 void appendBuffer(buffer *buff, const char *string, int length) {
-  char *new = realloc(buff->content, buff->length + length);
+  char *end = extendBuffer(buff, length);
 
-  if (new == NULL)
+  if (end == NULL)
     return;
 
-  memcpy(&new[buff->length], string, length);
-  buff->content = new;
-  buff->length += length;
+  memcpy(end, string, length);
 }
 
 void freeBuffer(buffer *buff) {
   free(buff->content);
 }
-
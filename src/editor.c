@@ -1,15 +1,17 @@
 #include <editor.h>
+#include <gap.h>
 #include <lines.h>
+#include <terminal.h>
 
 const char *pairs[] = { "{}", "[]", "()", "\"\"", "\'\'", NULL };
 
 void editorInsertChar(int c) {
-  editorLineInsertChar(&E.lines[E.cursorY], E.cursorX, c);
+  gapInsertChar(E.cursorY, E.cursorX, c);
   E.cursorX++;
 
   for (int i = 0; pairs[i]; i++) {
     if (c == pairs[i][0]) {
-      editorLineInsertChar(&E.lines[E.cursorY], E.cursorX, pairs[i][1]);
+      gapInsertChar(E.cursorY, E.cursorX, pairs[i][1]);
       break;
     }
   }
@@ -18,16 +20,66 @@ void editorInsertChar(int c) {
   E.dirty = true;
 }
 
+// Inserts text at the cursor as it is, without closing pairs, splicing
+// all of its lines in at once
+void editorInsertText(char *text, size_t length) {
+  editorLine *line = editorGetLine(E.cursorY);
+
+  char *newline = memchr(text, LINE_FEED, length);
+  size_t first = newline ? (size_t)(newline - text) : length;
+
+  if (first == length) {
+    editorLineInsertString(line, E.cursorX, text, length);
+    E.cursorX += length;
+  }
+  else {
+    // What followed the cursor ends up after the last inserted line
+    int tailLength = line->length - E.cursorX;
+    char *tail = malloc(tailLength + 1);
+    memcpy(tail, &line->content[E.cursorX], tailLength);
+
+    editorLineDeleteString(line, E.cursorX, tailLength);
+    editorLineAppendString(line, text, first);
+    first++;
+
+    E.cursorY += editorInsertLines(E.cursorY + 1, &text[first], length - first);
+
+    line = editorGetLine(E.cursorY);
+    E.cursorX = line->length;
+    editorLineAppendString(line, tail, tailLength);
+    free(tail);
+  }
+
+  E.highestLastX = E.cursorX;
+  E.dirty = true;
+}
+
+void editorPaste(void) {
+  size_t length;
+  char *text = editorReadPaste(&length);
+
+  // Terminals send the line breaks of a paste as returns
+  size_t kept = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (text[i] == RETURN && i + 1 < length && text[i + 1] == LINE_FEED)
+      continue;
+    text[kept++] = text[i] == RETURN ? LINE_FEED : text[i];
+  }
+
+  editorInsertText(text, kept);
+  free(text);
+}
+
 void editorDeleteChar(void) {
   if (E.cursorX == 0 && E.cursorY == 0) return;
 
-  editorLine *line = &E.lines[E.cursorY];
   if (E.cursorX > 0) {
-    editorLineDeleteChar(line, --E.cursorX);
+    gapDeleteChar(E.cursorY, --E.cursorX);
   }
   else {
-    E.cursorX = E.lines[E.cursorY - 1].length;
-    editorLineAppendString(&E.lines[E.cursorY - 1], line->content, line->length);
+    editorLine *line = editorGetLine(E.cursorY);
+    E.cursorX = editorGetLine(E.cursorY - 1)->length;
+    editorLineAppendString(editorGetLine(E.cursorY - 1), line->content, line->length);
     editorDeleteLine(E.cursorY);
     E.cursorY--;
   }
@@ -41,15 +93,11 @@ void editorInsertNewLine(void) {
     editorInsertLine(E.cursorY, EMPTY_STRING, 0);
   }
   else {
-    editorLine *line = &E.lines[E.cursorY];
+    editorLine *line = editorGetLine(E.cursorY);
     editorInsertLine(E.cursorY + 1, &line->content[E.cursorX], line->length - E.cursorX);
  
-    line = &E.lines[E.cursorY];
-    line->length = E.cursorX; 
-    line->content = realloc(line->content, line->length + 1);
-    line->content[line->length] = '\0';
-
-    editorUpdateLine(line);
+    line = editorGetLine(E.cursorY);
+    editorLineDeleteString(line, E.cursorX, line->length - E.cursorX);
     E.cursorX = 0;
   }
 
@@ -4,32 +4,67 @@
 
 #include <fileio.h>
 #include <highlight.h>
+#include <highlighter.h>
 #include <input.h>
+#include <journal.h>
 #include <lines.h>
 #include <output.h>
+#include <pieces.h>
+#include <saver.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <terminal.h>
+#include <undo.h>
 
-char *editorLinesToString(int *buflen) {
-  int total_len = 0;
-  for (int i = 0; i < E.numlines; i++)
-    total_len += E.lines[i].length + 1;
-  *buflen = total_len; 
-
-  char *buf = malloc(total_len);
-  char *p = buf;
-  for (int i = 0; i < E.numlines; i++) {
-    memcpy(p, E.lines[i].content, E.lines[i].length);
-    p += E.lines[i].length;
-    *p = LINE_FEED;
-    p++;
+char *pieceLineContent(linePiece *piece, int i, int *length) {
+  if (piece->isOriginal)
+    return originalLineContent(piece->start + i, length);
+
+  editorLine *line = addedLine(piece->start + i);
+  *length = line->length;
+  return line->content;
+}
+
+// Writes the lines of a piece to 'dest', or only measures them when it is NULL
+size_t pieceContent(linePiece *piece, char *dest) {
+  const char *eol = originalIsCRLF() ? "\r\n" : "\n";
+  int eolLength = strlen(eol);
+  size_t total = 0;
+  int i = 0;
+
+  // Lines of an LF-only file are already laid out the way they are saved,
+  // except for a last line without a newline
+  if (piece->isOriginal && E.original.index.crlf == 0) {
+    char *content = originalLinesContent(piece->start, piece->count, &total);
+
+    if (total && content[total - 1] == LINE_FEED)
+      i = piece->count;
+    else
+      content = originalLinesContent(piece->start, i = piece->count - 1, &total);
+
+    if (dest)
+      memcpy(dest, content, total);
   }
 
-  return buf;
+  for (; i < piece->count; i++) {
+    int length;
+    char *content = pieceLineContent(piece, i, &length);
+
+    if (dest) {
+      memcpy(dest + total, content, length);
+      memcpy(dest + total + length, eol, eolLength);
+    }
+    total += length + eolLength;
+  }
+
+  return total;
 }
 
 void editorOpen(char *filename) {
   if (filename == NULL) {
+    E.undo.isSuspended = true;
     editorInsertLine(E.numlines, EMPTY_STRING, 0);
+    E.undo.isSuspended = false;
     E.splashScreen = true;
     return;
   }
@@ -38,22 +73,48 @@ void editorOpen(char *filename) {
 
   editorSelectSyntaxHighlight();
 
-  FILE *file = fopen(filename, "r");
-  if (file == NULL)
-    die("fopen");
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    die("open");
+
+  editorLoadFile(fd);
+  close(fd);
 
-  char *line = NULL;
-  size_t capacity = 0;
-  ssize_t length;
+  journalOpen();
+}
 
-  while ((length = getline(&line, &capacity, file)) != -1) {
-    while (length > 0 && (line[length - 1] == LINE_FEED || line[length - 1] == RETURN))
-      length--;
-    editorInsertLine(E.numlines, line, length);
+void editorLoadFile(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+    die("fstat");
+
+  // Regular files are mapped rather than read, so only the pages that are
+  // actually displayed or edited are ever brought into memory
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    char *content = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (content != MAP_FAILED) {
+      editorLoadLines(content, st.st_size, true);
+      return;
+    }
   }
 
-  free(line);
-  fclose(file);
+  size_t capacity = st.st_size > 0 ? st.st_size : 4096;
+  char *content = malloc(capacity);
+  size_t length = 0;
+  ssize_t n;
+
+  while ((n = read(fd, content + length, capacity - length)) > 0) {
+    length += n;
+    if (length == capacity) {
+      capacity *= 2;
+      content = realloc(content, capacity);
+    }
+  }
+
+  if (n == -1)
+    die("read");
+
+  editorLoadLines(content, length, false);
 }
 
 void editorSave(void) {
@@ -66,25 +127,18 @@ void editorSave(void) {
     editorSelectSyntaxHighlight();
   }
 
-  int len;
-  char *buf = editorLinesToString(&len);
+  if (E.saver.current) {
+    editorSetStatusMessage("Still saving %s", E.saver.current->path);
+    return;
+  }
 
-  int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+  // Lines still being indexed in the background are part of the file too
+  editorLoadIndexedLines();
 
-  if (fd != -1) {
-    if (ftruncate(fd, len) != -1) {
-      if (write(fd, buf, len) == len) {
-        close(fd);
-        free(buf);
-        editorSetStatusMessage("%d bytes written to disk", len);
-        E.dirty = false;
-        return;
-      }
-    }
-    close(fd);
-  }
+  // A link is saved through, to the file it points at
+  char *path = realpath(E.filename, NULL);
+  if (path == NULL)
+    path = strdup(E.filename);
 
-  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
-  free(buf);
+  saverPost(path);
 }
-
@@ -1,119 +1,419 @@
+#define _DEFAULT_SOURCE
+
 #include <finder.h>
+#include <gap.h>
 #include <highlight.h>
 #include <input.h>
 #include <lines.h>
+#include <matcher.h>
 #include <output.h>
+#include <pieces.h>
+#include <regexp.h>
+#include <scanner.h>
+#include <searcher.h>
 #include <tools.h>
 
-char *findLastOccurrence(char *lasMatch, char *query, char *lineContent) {
-  char *prev = NULL;
-  char *cur = lineContent;
+// The buffer is searched a piece at a time: lines of the original file in
+// one go where they lie in the mapped file, so none of them is loaded just
+// to be looked at, and added lines one by one. Matches are columns of the
+// text itself rather than of its rendering, and never span lines
+
+// Tells which of the original lines [first, first + count) holds 'offset'
+int findOriginalLine(int first, int count, size_t offset) {
+  int low = first, high = first + count - 1;
 
-  while (true) {
-    cur = strstr(cur, query);
-    if (cur == lasMatch) break;
-    prev = cur;
-    cur++;
+  while (low < high) {
+    int middle = low + (high - low + 1) / 2;
+    if (lineIndexOffset(&E.original.index, middle) <= offset)
+      low = middle;
+    else
+      high = middle - 1;
   }
-  return prev;
+  return low;
 }
 
-bool editorFindCallback(char *query, int key) {
-  static int current;
-  static int direction;
-  static char *match = NULL;
+// Tells which of the original lines [line, end) holds 'offset', which is
+// mostly on 'line' or close past it when matches are collected in order
+int findOriginalLineFrom(int line, int end, size_t offset) {
+  int step = 1;
 
-  clearSearchHighlight();
-
-  if (E.numlines == 0 || *query == '\0' || key == RETURN || key == ESC) {
-    return false;
+  while (line + step < end && lineIndexOffset(&E.original.index, line + step) <= offset) {
+    line += step;
+    step *= 2;
   }
+  return findOriginalLine(line, min(step, end - line), offset);
+}
 
-  if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-    direction = 1; 
-  }
-  else if (key == ARROW_LEFT || key == ARROW_UP) {
-    direction = -1; 
+// Turns a match in original lines [first, first + count) into the number
+// of lines it is past 'first' and its column
+int findOriginalMatch(char *match, int first, int count, int *matchCol) {
+  size_t offset = match - E.original.content;
+  int line = findOriginalLine(first, count, offset);
+
+  *matchCol = offset - lineIndexOffset(&E.original.index, line);
+  return line - first;
+}
+
+void findClear(void) {
+  free(E.find.source);
+  E.find.source = NULL;
+  E.find.error = NULL;
+  regexpFree(&E.find.regex);
+}
+
+// Returns the first match in text[0, length), whose first line only starts
+// a line if 'isLineStart'
+char *findNextIn(findQuery *query, char *text, size_t length, bool isLineStart, int *matchLength) {
+  if (query->isRegex) {
+    size_t found;
+    char *match = regexpNext(&query->regex, text, length, isLineStart, &found);
+    *matchLength = found;
+    return match;
   }
-  else {
-    current = E.savedLastY;
-    direction = 1;
-    match = E.lines[current].renderContent + E.savedLastX;
+
+  *matchLength = query->pattern.length;
+  return matcherNext(&query->pattern, text, length);
+}
+
+// Returns the last match starting before 'limit' in text[0, length), which
+// holds whole lines
+char *findPreviousIn(findQuery *query, char *text, size_t length, size_t limit, int *matchLength) {
+  if (query->isRegex) {
+    size_t found;
+    char *match = regexpPrevious(&query->regex, text, length, limit, &found);
+    *matchLength = found;
+    return match;
   }
 
-  int lastMatchIndex;
-  char *lastMatch;
+  // Matches starting before the limit may still run past it
+  size_t reach = limit + query->pattern.length - 1;
 
-  int limit = current;
-  bool found = false;
+  *matchLength = query->pattern.length;
+  return matcherPrevious(&query->pattern, text, reach < length ? reach : length);
+}
 
-  while (true) {
-    editorLine *line = &E.lines[current];
+char *findLineContent(linePiece *piece, int line, int *length) {
+  if (piece->isOriginal) return originalLineContent(line, length);
 
-    // Same line
-    if (match) {
-      match = direction == -1
-        ? findLastOccurrence(match, query, line->renderContent)
-        : strstr(match + 1, query);
-    }
+  *length = addedLine(line)->length;
+  return addedLine(line)->content;
+}
 
-    // Next Line
-    if (!match) {
-      // Highlight case
-      if (found && current + direction == limit) break;
+int findLineLength(linePiece *piece, int line) {
+  int length;
+  findLineContent(piece, line, &length);
+  return length;
+}
 
-      // Search case
-      int nextLine = mod(current + direction, E.numlines);
-      current = nextLine;
-      line = &E.lines[current];
+// Looks for the first match from column 'col' of 'row' on, before row 'to'
+bool findForward(findQuery *query, int row, int col, int to, findMatch *found) {
+  gapClose();
 
-      match = direction == -1
-        ? findLastOccurrence(match, query, line->renderContent)
-        : strstr(line->renderContent, query);
+  while (row < to) {
+    int offset;
+    linePiece *piece = piecesFind(row, &offset);
+    int count = min(piece->count - offset, to - row);
+    int first = piece->start + offset;
 
-      if (!match && current == limit) break;
+    // Nothing starts past the end of a line
+    if (col > 0 && col > findLineLength(piece, first)) {
+      row++;
+      col = 0;
+      continue;
     }
 
-    if (match) {
-      if (!found) {
-        E.cursorY = current;
-        E.cursorX = editorLineRxToCx(line, match - line->renderContent);
+    if (piece->isOriginal) {
+      size_t length;
+      char *content = originalLinesContent(first, count, &length);
+
+      char *match = findNextIn(query, content + col, length - col, col == 0, &found->length);
+      if (match) {
+        found->row = row + findOriginalMatch(match, first, count, &found->col);
+        return true;
+      }
+    }
+    else {
+      for (int i = 0; i < count; i++) {
+        editorLine *line = addedLine(first + i);
+        int skip = i == 0 ? col : 0;
+
+        char *match = findNextIn(query, line->content + skip, line->length - skip, skip == 0, &found->length);
+        if (match) {
+          found->row = row + i;
+          found->col = match - line->content;
+          return true;
+        }
+      }
+    }
 
-        E.rowOffset = E.screenRows <= E.cursorY
-          ? E.cursorY - E.screenRows / 2
-          : E.numlines;
+    row += count;
+    col = 0;
+  }
 
-        editorScrollY();
+  return false;
+}
 
-        found = true;
+// Looks for the last match that starts before column 'col' of 'row', going
+// up to row 'to'
+bool findBackward(findQuery *query, int row, int col, int to, findMatch *found) {
+  gapClose();
 
-        lastMatchIndex = current;
-        lastMatch = match;
-        direction = 1;
+  while (row >= to) {
+    int offset;
+    linePiece *piece = piecesFind(row, &offset);
+    int count = min(offset + 1, row - to + 1);
+    int first = piece->start + offset - count + 1;
+    row -= count;
 
-        current = E.rowOffset;
-        limit = min(E.rowOffset + E.screenRows, E.numlines);
+    if (piece->isOriginal) {
+      size_t length;
+      char *content = originalLinesContent(first, count, &length);
+      size_t last = lineIndexOffset(&E.original.index, first + count - 1) - (content - E.original.content);
 
-        match = E.lines[current].renderContent - 1;
+      char *match = findPreviousIn(query, content, length, last + col, &found->length);
+      if (match) {
+        found->row = row + 1 + findOriginalMatch(match, first, count, &found->col);
+        return true;
       }
-      else {
-        colorLine(line, match - line->renderContent, theme.match.unselected, strlen(query));
+    }
+    else {
+      for (int i = count - 1; i >= 0; i--) {
+        editorLine *line = addedLine(first + i);
+        int limit = i == count - 1 ? col : INT_MAX;
+
+        char *match = findPreviousIn(query, line->content, line->length, limit, &found->length);
+        if (match) {
+          found->row = row + 1 + i;
+          found->col = match - line->content;
+          return true;
+        }
       }
     }
+
+    col = INT_MAX;
+  }
+
+  return false;
+}
+
+void findIndexClear(void) {
+  E.matches.count = 0;
+  E.matches.isComplete = false;
+  E.matches.total = 0;
+  E.matches.isCounted = false;
+}
+
+// Keeps the matches of the shorter query the query now starts with where
+// the whole of it still matches
+void findIndexNarrow(void) {
+  gapClose();
+
+  int n = E.find.pattern.length;
+  int kept = 0;
+
+  for (int i = 0; i < E.matches.count; i++) {
+    findMatch *match = &E.matches.matches[i];
+    int offset, length;
+    linePiece *piece = piecesFind(match->row, &offset);
+    char *content = findLineContent(piece, piece->start + offset, &length);
+
+    if (match->col + n <= length && !memcmp(content + match->col, E.find.source, n)) {
+      match->length = n;
+      E.matches.matches[kept++] = *match;
+    }
+  }
+
+  E.matches.count = E.matches.total = kept;
+}
+
+// Compiles the source of a query, returning what is wrong with it when it
+// does not compile
+const char *findQueryCompile(findQuery *query) {
+  if (query->isRegex)
+    return regexpCompile(&query->regex, query->source);
+
+  matcherCompile(&query->pattern, query->source, strlen(query->source));
+  return NULL;
+}
+
+// Compiles the query typed so far, unless it is the one compiled already,
+// tells whether it can be searched for and has its matches counted
+bool findCompile(char *query) {
+  if (E.find.source && !strcmp(E.find.source, query))
+    return E.find.error == NULL;
+
+  // Typing on only ever drops matches of a literal query
+  bool isLonger = !E.find.isRegex && E.matches.isComplete &&
+    !strncmp(query, E.find.source, strlen(E.find.source));
+
+  findClear();
+  E.find.source = strdup(query);
+  E.find.error = findQueryCompile(&E.find);
+
+  if (E.find.error) {
+    searcherCancel();
+    findIndexClear();
+    return false;
+  }
+
+  if (isLonger) {
+    findIndexNarrow();
+  }
+  else {
+    findIndexClear();
+    E.matches.changes = E.changes;
+    searcherPost(&E.find);
+  }
+
+  return true;
+}
+
+// Tells how many of the matches collected start before column 'col' of 'row'
+int findIndexRank(int row, int col) {
+  int low = 0, high = E.matches.count;
+
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    findMatch *match = &E.matches.matches[middle];
+
+    if (match->row < row || (match->row == row && match->col < col))
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+// Picks the collected match closest past column 'col' of 'row' in the
+// direction given, wrapping around the buffer
+bool findIndexPick(int direction, int row, int col, findMatch *found) {
+  int count = E.matches.count;
+  if (count == 0) return false;
+
+  int rank = direction == 1 ? findIndexRank(row, col + 1) : findIndexRank(row, col) - 1;
+  *found = E.matches.matches[(rank + count) % count];
+  return true;
+}
+
+void findColorMatch(editorLine *line, int col, int length, unsigned char token) {
+  int start = editorLineCxToRx(line, col);
+  colorLine(line, start, token, editorLineCxToRx(line, col + length) - start);
+}
+
+// Colors every match on the rows shown, and the selected one apart
+void findHighlightMatches(findQuery *query, findMatch *selected) {
+  int last = min(E.rowOffset + E.screenRows, E.numlines);
+
+  for (int row = E.rowOffset; row < last; row++) {
+    editorLine *line = editorGetLine(row);
+    int at = 0, length;
+    char *match;
+
+    while (at <= line->length && (match = findNextIn(query, line->content + at, line->length - at, at == 0, &length))) {
+      int col = match - line->content;
+      findColorMatch(line, col, length, TOKEN_MATCH);
+      at = col + 1;
+    }
+  }
+
+  findColorMatch(editorGetLine(selected->row), selected->col, selected->length, TOKEN_SELECTED_MATCH);
+}
+
+bool editorFindCallback(char *query, int key) {
+  static int current;
+  static int column;
+
+  clearSearchHighlight();
+
+  if (E.numlines == 0 || *query == '\0' || key == RETURN || key == ESC || !findCompile(query)) {
+    return false;
+  }
+
+  int direction = 1;
+
+  if (key == ARROW_LEFT || key == ARROW_UP) {
+    direction = -1;
+  }
+  else if (key != ARROW_RIGHT && key != ARROW_DOWN) {
+    current = E.savedLastY;
+    column = E.savedLastX;
   }
 
+  // The closest match past the last one, wrapping around the buffer
+  findMatch match;
+  bool found;
+
+  if (E.matches.isComplete)
+    found = findIndexPick(direction, current, column, &match);
+  else
+    found = direction == 1
+      ? findForward(&E.find, current, column + 1, E.numlines, &match) ||
+        findForward(&E.find, 0, 0, current + 1, &match)
+      : findBackward(&E.find, current, column, 0, &match) ||
+        findBackward(&E.find, E.numlines - 1, INT_MAX, current, &match);
+
   if (found) {
-    current = lastMatchIndex;
-    match = lastMatch;
-    editorLine *line = &E.lines[current];
-    colorLine(line, match - line->renderContent, theme.match.selected, strlen(query));
+    current = match.row;
+    column = match.col;
+
+    E.cursorY = match.row;
+    E.cursorX = match.col;
+
+    E.rowOffset = E.screenRows <= E.cursorY
+      ? E.cursorY - E.screenRows / 2
+      : E.numlines;
+
+    editorScrollY();
+    editorHighlightRows(E.rowOffset, E.rowOffset + E.screenRows);
+    findHighlightMatches(&E.find, &match);
   }
 
   return found;
 }
 
-void editorFind(void) {
-  char *query = editorPrompt("Search: %s", editorFindCallback);
+// Opens the search prompt for a literal query or a regular expression,
+// which is told about once the prompt is closed when it does not compile
+void findPrompt(char *prompt, bool isRegex) {
+  searcherCancel();
+  findClear();
+  findIndexClear();
+  E.find.isRegex = isRegex;
+
+  char *query = editorPrompt(prompt, editorFindCallback);
+
+  // The matches of a search left with Return stay counted on the status bar
+  if (query == NULL) {
+    searcherCancel();
+    findIndexClear();
+  }
+  else if (E.find.error) {
+    editorSetStatusMessage("Bad pattern: %s", E.find.error);
+  }
   free(query);
 }
 
+// Tells how many matches the last search has, which is -1 while they are
+// still being counted, and which of them the cursor is on, or -1
+bool findPosition(int *current, int *total) {
+  if (E.matches.changes != E.changes || !(E.matches.isCounted || E.searcher.job))
+    return false;
+
+  *total = E.matches.isCounted ? E.matches.total : -1;
+  *current = -1;
+
+  if (E.matches.isComplete) {
+    int rank = findIndexRank(E.cursorY, E.cursorX);
+
+    if (rank < E.matches.count && E.matches.matches[rank].row == E.cursorY && E.matches.matches[rank].col == E.cursorX)
+      *current = rank;
+  }
+  return true;
+}
+
+void editorFind(void) {
+  findPrompt("Search: %s", false);
+}
+
+void editorFindRegex(void) {
+  findPrompt("/%s", true);
+}
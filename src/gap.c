@@ -0,0 +1,393 @@
+#include <gap.h>
+#include <highlight.h>
+#include <lines.h>
+#include <slab.h>
+#include <tools.h>
+#include <undo.h>
+
+// Typing goes through a gap kept at the cursor of the line being edited,
+// so each key only moves the few bytes between the gap and the cursor.
+// The gap stays open from frame to frame, and drawing renders and colors
+// only the part of the line on the screen, from the closest of the
+// checkpoints the highlighter leaves along it. A change only drops the
+// checkpoints around it, and finding how the line ends stops as soon as
+// the highlighter is back in a state it had past the change. Anything
+// else reaching for that line goes through editorGetLine, which closes
+// the gap and renders the line again first
+
+void gapMove(int at) {
+  char *content = E.gap.line->content;
+
+  if (at < E.gap.start) {
+    int count = E.gap.start - at;
+    memmove(&content[E.gap.end - count], &content[at], count);
+    E.gap.start -= count;
+    E.gap.end -= count;
+  }
+  else if (at > E.gap.start) {
+    int count = at - E.gap.start;
+    memmove(&content[E.gap.start], &content[E.gap.end], count);
+    E.gap.start += count;
+    E.gap.end += count;
+  }
+}
+
+void gapReserve(void) {
+  if (E.gap.start < E.gap.end) return;
+
+  int grow = max(E.gap.capacity, LINE_GAP_SIZE);
+  int tail = E.gap.capacity - E.gap.end;
+
+  // One more byte for the terminator the line gets back when closed
+  E.gap.line->content = slabRealloc(E.gap.line->content, E.gap.capacity + grow + 1);
+  memmove(&E.gap.line->content[E.gap.end + grow], &E.gap.line->content[E.gap.end], tail);
+
+  E.gap.end += grow;
+  E.gap.capacity += grow;
+}
+
+editorLine *gapOpen(int row) {
+  if (E.gap.line && E.gap.row == row)
+    return E.gap.line;
+
+  gapClose();
+  editorLine *line = editorGetLine(row);
+
+  // A render pointing to the content would not follow it around
+  editorDropRender(line);
+
+  E.gap.line = line;
+  E.gap.row = row;
+  E.gap.start = E.gap.end = E.gap.capacity = line->length;
+  gapResetCheckpoints(line->startsInComment);
+  return line;
+}
+
+// Reads column 'cx' of the line being typed into, gap left out
+char gapChar(int cx) {
+  return E.gap.line->content[cx < E.gap.start ? cx : cx + E.gap.end - E.gap.start];
+}
+
+// How far past a column the highlighter may read, and so how far back a
+// change reaches
+int gapLookahead(void) {
+  return (E.syntax ? E.syntax->tables->maxLength : 0) + 16;
+}
+
+gapCheckpoint *gapAppend(gapCheckpoint **list, int *count, int *capacity) {
+  if (*count == *capacity) {
+    *capacity = max(16, *capacity * 2);
+    *list = realloc(*list, sizeof(gapCheckpoint) * *capacity);
+  }
+  return &(*list)[(*count)++];
+}
+
+// Forgets where the highlighter stood along the line, which now starts in
+// 'inComment', except at its start
+void gapResetCheckpoints(bool inComment) {
+  E.gap.startsInComment = inComment;
+  E.gap.isEndKnown = false;
+  E.gap.isRendered = false;
+  E.gap.numcheckpoints = E.gap.numstale = 0;
+
+  gapCheckpoint *start = gapAppend(&E.gap.checkpoints, &E.gap.numcheckpoints, &E.gap.checkpointsCapacity);
+  *start = (gapCheckpoint){0, 0, {true, inComment, 0, 0, TOKEN_TEXT, TOKEN_TEXT}};
+}
+
+// Counts the checkpoints whose column, in content or on screen, is at most
+// 'column'
+int gapCheckpointsUpTo(int column, bool onScreen) {
+  int low = 0, high = E.gap.numcheckpoints;
+
+  while (low < high) {
+    int mid = (low + high) / 2;
+    int at = onScreen ? E.gap.checkpoints[mid].rx : E.gap.checkpoints[mid].cx;
+
+    if (at <= column)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+// Screen column after columns [from, to) of the line when 'from' is at 'rx'
+int gapAdvance(int from, int rx, int to) {
+  for (int cx = from; cx < to; cx++)
+    rx += gapChar(cx) == TAB ? TAB_SIZE - rx % TAB_SIZE : 1;
+  return rx;
+}
+
+// Renders columns [from, to) of the line into the scratch line, uncolored,
+// noting where on screen each of them starts
+void gapRenderSpan(int from, int rx, int to) {
+  editorLine *scratch = &E.gap.scratch;
+  int size = gapAdvance(from, rx, to) - rx;
+
+  scratch->renderContent = realloc(scratch->renderContent, size + 1);
+  scratch->highlight = realloc(scratch->highlight, size + 1);
+  E.gap.columns = realloc(E.gap.columns, sizeof(int) * (size + 1));
+
+  // Columns in the middle of a tab are not where any character starts
+  int index = 0;
+  for (int cx = from; cx < to; cx++) {
+    char c = gapChar(cx);
+    E.gap.columns[index] = cx;
+
+    if (c == TAB) {
+      scratch->renderContent[index++] = SPACE;
+      while ((rx + index) % TAB_SIZE != 0) {
+        E.gap.columns[index] = -1;
+        scratch->renderContent[index++] = SPACE;
+      }
+    }
+    else {
+      scratch->renderContent[index++] = c;
+    }
+  }
+
+  scratch->renderContent[index] = '\0';
+  scratch->renderLength = index;
+  E.gap.columns[index] = to;
+  colorLine(scratch, 0, TOKEN_TEXT, index);
+}
+
+bool gapSameState(highlightController *a, highlightController *b) {
+  return a->isPrevSep == b->isPrevSep && a->inComment == b->inComment && a->inString == b->inString &&
+    a->prevHL == b->prevHL && a->rest == b->rest;
+}
+
+// The line ends the way it did before the last change if the highlighter
+// stands at a stale checkpoint the way it did then
+bool gapResync(int *stale, int cx, highlightController *hc) {
+  int length = E.gap.line->length;
+
+  while (*stale >= 0 && length - E.gap.stale[*stale].cx < cx)
+    (*stale)--;
+
+  if (*stale < 0 || length - E.gap.stale[*stale].cx != cx || !gapSameState(&E.gap.stale[*stale].state, hc))
+    return false;
+
+  E.gap.endsInComment = E.gap.staleEnd;
+  E.gap.isEndKnown = true;
+  return true;
+}
+
+// Moves the highlighter along the line from its last checkpoint, leaving
+// one every GAP_CHECKPOINT_INTERVAL columns, until one is past column 'cx'
+// or screen column 'rx', or with 'toEnd' until it knows how the line ends
+void gapWalk(int cx, int rx, bool toEnd) {
+  editorLine *scratch = &E.gap.scratch;
+  int length = E.gap.line->length;
+  int stale = E.gap.numstale - 1;
+
+  while (true) {
+    gapCheckpoint at = E.gap.checkpoints[E.gap.numcheckpoints - 1];
+
+    // Past a comment or include running to the end nothing is colored
+    // any other way, and neither is a line without syntax
+    bool isPlain = E.syntax == NULL || at.state.rest != TOKEN_TEXT;
+
+    if (at.cx >= length || isPlain) {
+      E.gap.endsInComment = at.state.inComment;
+      E.gap.isEndKnown = true;
+      E.gap.numstale = 0;
+    }
+
+    if (at.cx >= length || (toEnd ? E.gap.isEndKnown : at.cx > cx || at.rx > rx))
+      return;
+
+    int stop = min(length, at.cx + GAP_CHECKPOINT_INTERVAL);
+
+    if (isPlain) {
+      gapCheckpoint *next = gapAppend(&E.gap.checkpoints, &E.gap.numcheckpoints, &E.gap.checkpointsCapacity);
+      *next = (gapCheckpoint){stop, gapAdvance(at.cx, at.rx, stop), at.state};
+      continue;
+    }
+
+    gapRenderSpan(at.cx, at.rx, min(length, stop + gapLookahead()));
+
+    highlightController hc = at.state;
+    hc.idx = 0;
+
+    while (true) {
+      int column = E.gap.columns[hc.idx];
+
+      if (column >= 0) {
+        highlightController here = hc;
+        here.idx = 0;
+        here.prevHL = hc.idx > 0 ? scratch->highlight[hc.idx - 1] : hc.prevHL;
+
+        if (toEnd && gapResync(&stale, column, &here))
+          return;
+
+        if (column >= stop || hc.idx >= scratch->renderLength) {
+          gapCheckpoint *next = gapAppend(&E.gap.checkpoints, &E.gap.numcheckpoints, &E.gap.checkpointsCapacity);
+          *next = (gapCheckpoint){column, at.rx + hc.idx, here};
+          break;
+        }
+      }
+
+      highlightRun(scratch, &hc, hc.idx + 1);
+
+      // The rest of the line is then all one token, from wherever it is
+      // picked up
+      if (hc.rest != TOKEN_TEXT) {
+        hc.idx = 0;
+        gapCheckpoint *next = gapAppend(&E.gap.checkpoints, &E.gap.numcheckpoints, &E.gap.checkpointsCapacity);
+        *next = (gapCheckpoint){E.gap.columns[scratch->renderLength], at.rx + scratch->renderLength, hc};
+        break;
+      }
+    }
+  }
+}
+
+// Drops the checkpoints a change at 'at' can move, keeping those past it
+// as stale while it is known how the line ends
+void gapForget(int at, bool isDelete) {
+  int length = E.gap.line->length;
+  int first = at + isDelete;
+  int keep = max(1, gapCheckpointsUpTo(at - gapLookahead() - 1, false));
+
+  // Stale checkpoints before the change lead nowhere, and neither do those
+  // the ones made since are about to take the place of
+  int past = first;
+  if (E.gap.isEndKnown)
+    past = max(past, E.gap.checkpoints[E.gap.numcheckpoints - 1].cx + 1);
+
+  while (E.gap.numstale > 0 && length - E.gap.stale[E.gap.numstale - 1].cx < past)
+    E.gap.numstale--;
+
+  if (E.gap.isEndKnown) {
+    for (int i = E.gap.numcheckpoints - 1; i >= keep && E.gap.checkpoints[i].cx >= first; i--) {
+      gapCheckpoint *stale = gapAppend(&E.gap.stale, &E.gap.numstale, &E.gap.staleCapacity);
+      *stale = E.gap.checkpoints[i];
+      stale->cx = length - stale->cx;
+    }
+    E.gap.staleEnd = E.gap.endsInComment;
+  }
+
+  E.gap.numcheckpoints = keep;
+  E.gap.isEndKnown = false;
+  E.gap.isRendered = false;
+}
+
+// Tells the screen column of column 'cx' of the line being typed into
+int gapCxToRx(int cx) {
+  gapWalk(cx, INT_MAX, false);
+
+  gapCheckpoint *from = &E.gap.checkpoints[gapCheckpointsUpTo(cx, false) - 1];
+  return gapAdvance(from->cx, from->rx, cx);
+}
+
+// Renders and colors the part of the line being typed into that is on the
+// screen, from the last checkpoint before it
+void gapRender(void) {
+  editorLine *line = E.gap.line;
+  int width = E.screenCols - E.sidebarWidth;
+
+  if (line == NULL) return;
+  if (E.gap.isRendered && E.gap.renderedOffset == E.colOffset && E.gap.renderedWidth == width) return;
+
+  gapWalk(INT_MAX, E.colOffset, false);
+
+  gapCheckpoint *from = &E.gap.checkpoints[gapCheckpointsUpTo(E.colOffset, true) - 1];
+  int to = min(line->length, from->cx + E.colOffset + width - from->rx + gapLookahead());
+  gapRenderSpan(from->cx, from->rx, to);
+
+  editorLine *scratch = &E.gap.scratch;
+  highlightController hc = from->state;
+
+  if (hc.rest != TOKEN_TEXT)
+    colorLine(scratch, 0, hc.rest, scratch->renderLength);
+  else if (E.syntax)
+    highlightRun(scratch, &hc, scratch->renderLength);
+
+  editorDropRender(line);
+  line->renderContent = slabAlloc(scratch->renderLength + 1);
+  memcpy(line->renderContent, scratch->renderContent, scratch->renderLength + 1);
+  line->highlight = slabRealloc(line->highlight, scratch->renderLength);
+  memcpy(line->highlight, scratch->highlight, scratch->renderLength);
+  line->renderLength = scratch->renderLength;
+  line->renderStart = from->rx;
+  line->hasOwnRender = true;
+
+  E.gap.isRendered = true;
+  E.gap.renderedOffset = E.colOffset;
+  E.gap.renderedWidth = width;
+}
+
+// Colors the line being typed into for the comment state it starts in and
+// returns the one it leaves, going along it no further than the screen
+// and the last change need
+bool gapHighlight(bool inComment) {
+  editorLine *line = E.gap.line;
+
+  if (inComment != E.gap.startsInComment)
+    gapResetCheckpoints(inComment);
+
+  gapRender();
+  if (!E.gap.isEndKnown)
+    gapWalk(INT_MAX, INT_MAX, true);
+
+  line->startsInComment = inComment;
+  line->isOpenComment = E.gap.endsInComment;
+  line->isHighlighted = true;
+  return E.gap.endsInComment;
+}
+
+// Copies the content of the line being typed into to 'dest', gap left out
+void gapCopy(char *dest) {
+  editorLine *line = E.gap.line;
+
+  memcpy(dest, line->content, E.gap.start);
+  memcpy(&dest[E.gap.start], &line->content[E.gap.end], E.gap.capacity - E.gap.end);
+}
+
+void gapClose(void) {
+  editorLine *line = E.gap.line;
+  if (line == NULL) return;
+
+  gapMove(line->length);
+  line->content[line->length] = '\0';
+  E.gap.line = NULL;
+
+  // The colors it has are only for the part of it that was on the screen
+  editorUpdateLine(line);
+  highlightPlain(line);
+}
+
+// Colors are dropped right away, as the text highlighted in the background
+// no longer matches the line, and so are the checkpoints around the change
+void gapInsertChar(int row, int at, int c) {
+  editorLine *line = gapOpen(row);
+
+  if (at < 0 || at > line->length)
+    at = line->length;
+
+  gapForget(at, false);
+  gapMove(at);
+  gapReserve();
+  line->content[E.gap.start++] = c;
+  line->length++;
+  undoPush(UNDO_INSERT_TEXT, row, at, 1, &line->content[at], 1);
+
+  line->isHighlighted = false;
+  highlightInvalidate(row);
+}
+
+void gapDeleteChar(int row, int at) {
+  editorLine *line = gapOpen(row);
+
+  if (at < 0 || at >= line->length)
+    return;
+
+  gapForget(at, true);
+  gapMove(at);
+  undoPush(UNDO_DELETE_TEXT, row, at, 1, &line->content[E.gap.end], 1);
+  E.gap.end++;
+  line->length--;
+
+  line->isHighlighted = false;
+  highlightInvalidate(row);
+}
@@ -1,11 +1,14 @@
+#include <gap.h>
 #include <highlight.h>
+#include <highlighter.h>
 #include <init.h>
+#include <lines.h>
+#include <pieces.h>
+#include <slab.h>
 #include <tools.h>
 
-void colorLine(editorLine *line, int start, color_t c, int len) {
-  for (int i = start, n = start + len; i < n; i++) {
-    line->highlight[i] = c;
-  }
+void colorLine(editorLine *line, int start, unsigned char token, int len) {
+  memset(&line->highlight[start], token, len);
 }
 
 bool highlightSinglelineComments(editorLine *line, highlightController *hc) {
@@ -14,8 +17,9 @@ bool highlightSinglelineComments(editorLine *line, highlightController *hc) {
   if (!singleline.length || hc->inString || hc->inComment) return false;
 
   if (!strncmp(&line->renderContent[hc->idx], singleline.value, singleline.length)) {
-    colorLine(line, hc->idx, theme.comment, line->renderLength - hc->idx);
+    colorLine(line, hc->idx, TOKEN_COMMENT, line->renderLength - hc->idx);
     hc->idx = line->renderLength;
+    hc->rest = TOKEN_COMMENT;
     return true;
   }
   return false;
@@ -29,19 +33,19 @@ bool highlightMultilineComments(editorLine *line, highlightController *hc) {
 
   if (hc->inComment) {
     if (!strncmp(&line->renderContent[hc->idx], multilineEnd.value, multilineEnd.length)) {
-      colorLine(line, hc->idx, theme.comment, multilineEnd.length);
+      colorLine(line, hc->idx, TOKEN_COMMENT, multilineEnd.length);
       hc->idx += multilineEnd.length;
       hc->inComment = false;
       hc->isPrevSep = true;
     }
     else {
-      line->highlight[hc->idx++] = theme.comment;
+      line->highlight[hc->idx++] = TOKEN_COMMENT;
     }
     return true;
   }
 
   if (!strncmp(&line->renderContent[hc->idx], multilineStart.value, multilineStart.length)) {
-    colorLine(line, hc->idx, theme.comment, multilineStart.length);
+    colorLine(line, hc->idx, TOKEN_COMMENT, multilineStart.length);
     hc->idx += multilineStart.length;
     hc->inComment = true;
     return true;
@@ -56,10 +60,10 @@ bool highlightStrings(editorLine *line, highlightController *hc) {
   if (!(E.syntax->flags & HIGHLIGHT_STRINGS)) return false;
 
   if (hc->inString) {
-    line->highlight[hc->idx] = theme.string;
+    line->highlight[hc->idx] = TOKEN_STRING;
 
     if (c == '\\' && hc->idx + 1 < line->renderLength) {
-      line->highlight[hc->idx + 1] = theme.string;
+      line->highlight[hc->idx + 1] = TOKEN_STRING;
       hc->idx += 2;
       return true;
     }
@@ -75,7 +79,7 @@ bool highlightStrings(editorLine *line, highlightController *hc) {
 
   if (c == '"' || c == '\'') {
     hc->inString = c;
-    line->highlight[hc->idx] = theme.string;
+    line->highlight[hc->idx] = TOKEN_STRING;
     hc->idx++;
     return true;
   }
@@ -89,12 +93,12 @@ bool highlightNumbers(editorLine *line, highlightController *hc) {
 
   if (!(E.syntax->flags & HIGHLIGHT_NUMBERS)) return false;
 
-  bool isPrevNumber = colorcmp(hc->prevHL, theme.number);
+  bool isPrevNumber = hc->prevHL == TOKEN_NUMBER;
   bool isInt = isdigit(c) && (hc->isPrevSep || isPrevNumber);
   bool isFloat = c == '.' && (isPrevNumber || isdigit(nextChar));
 
   if (isInt || isFloat) {
-    line->highlight[hc->idx] = theme.number;
+    line->highlight[hc->idx] = TOKEN_NUMBER;
     hc->isPrevSep = false;
     hc->idx++;
     return true;
@@ -102,111 +106,348 @@ bool highlightNumbers(editorLine *line, highlightController *hc) {
   return false;
 }
 
+// A keyword is always a whole run of non-separator characters, so the run
+// starting here is looked up as is
 bool highlightKeywords(editorLine *line, highlightController *hc) {
-  char **keywords = E.syntax->keywords;
+  syntaxTables *tables = E.syntax->tables;
 
   if (!hc->isPrevSep)
     return false;
 
-  int j;
-  for (j = 0; keywords[j]; j++) {
-    int klen = strlen(keywords[j]);
-    bool isPreprocessor = *keywords[j] == '#';
-    bool isDatatype = keywords[j][klen - 1] == '|';
-
-    if (isDatatype) klen--;
-  
-    if (hc->idx + klen > line->renderLength)
-      continue;
-
-    if (!strncmp(&line->renderContent[hc->idx], keywords[j], klen) && 
-        isSeparator(line->renderContent[hc->idx + klen]))
-    {
-      color_t color = isDatatype ? theme.datatype : isPreprocessor ? theme.preprocessor : theme.keyword;
-      colorLine(line, hc->idx, color, klen);
-      hc->idx += klen;
-
-      if (!strcmp(keywords[j], "#include")) {
-        colorLine(line, hc->idx, theme.string, line->renderLength - hc->idx);
-        hc->idx = line->renderLength;
-      }
+  char *token = &line->renderContent[hc->idx];
+  int length = 0;
 
-      hc->isPrevSep = false;
-      break;
-    }
+  while (length <= tables->maxLength && !(tables->classes[(unsigned char)token[length]] & CLASS_SEPARATOR))
+    length++;
+
+  syntaxKeyword *keyword = highlightFindKeyword(tables, token, length);
+
+  if (keyword == NULL)
+    return false;
+
+  colorLine(line, hc->idx, keyword->token, length);
+  hc->idx += length;
+
+  if (keyword->isInclude) {
+    colorLine(line, hc->idx, TOKEN_STRING, line->renderLength - hc->idx);
+    hc->idx = line->renderLength;
+    hc->rest = TOKEN_STRING;
   }
 
-  return keywords[j] != NULL;
+  hc->isPrevSep = false;
+  return true;
 }
 
 bool highlightOperators(editorLine *line, highlightController *hc) {
-  return highlightSymbols(line, hc, E.syntax->operators, theme.operators);
+  return highlightSymbols(line, hc, CLASS_OPERATOR, TOKEN_OPERATOR);
 }
 
 bool highlightBrackets(editorLine *line, highlightController *hc) {
-  return highlightSymbols(line, hc, E.syntax->brackets, theme.brackets);
+  return highlightSymbols(line, hc, CLASS_BRACKET, TOKEN_BRACKET);
 }
 
 bool highlightEndStatemetns(editorLine *line, highlightController *hc) {
-  return highlightSymbols(line, hc, E.syntax->endStatements, theme.endStatement);
+  return highlightSymbols(line, hc, CLASS_END_STATEMENT, TOKEN_END_STATEMENT);
 }
 
-bool highlightSymbols(editorLine *line, highlightController *hc, char **symbols, color_t color) {
-  int j;
-  for (j = 0; symbols[j]; j++) {
-    if (line->renderContent[hc->idx] == *symbols[j]) {
-      colorLine(line, hc->idx, color, 1);
-      hc->idx++;
-      hc->isPrevSep = true;
-      break;
+bool highlightSymbols(editorLine *line, highlightController *hc, int class, unsigned char token) {
+  if (!(E.syntax->tables->classes[(unsigned char)line->renderContent[hc->idx]] & class))
+    return false;
+
+  colorLine(line, hc->idx, token, 1);
+  hc->idx++;
+  hc->isPrevSep = true;
+  return true;
+}
+
+unsigned int keywordHash(const char *value, int length, unsigned int seed) {
+  unsigned int hash = seed;
+  for (int i = 0; i < length; i++)
+    hash = (hash ^ (unsigned char)value[i]) * 16777619u;
+  return hash;
+}
+
+syntaxKeyword *highlightFindKeyword(syntaxTables *tables, char *token, int length) {
+  if (length == 0 || length > tables->maxLength)
+    return NULL;
+
+  syntaxKeyword *keyword = &tables->keywords[keywordHash(token, length, tables->seed) & (tables->size - 1)];
+
+  if (keyword->length != length || memcmp(keyword->value, token, length))
+    return NULL;
+  return keyword;
+}
+
+// Tries to place every keyword in its own slot for the given seed
+bool highlightHashKeywords(syntaxTables *tables, syntaxKeyword *keywords, int count, unsigned int seed) {
+  memset(tables->keywords, 0, sizeof(syntaxKeyword) * tables->size);
+
+  for (int i = 0; i < count; i++) {
+    syntaxKeyword *slot = &tables->keywords[keywordHash(keywords[i].value, keywords[i].length, seed) & (tables->size - 1)];
+    if (slot->value) return false;
+    *slot = keywords[i];
+  }
+
+  tables->seed = seed;
+  return true;
+}
+
+void highlightCompileSyntax(editorSyntax *syntax) {
+  syntaxTables *tables = calloc(1, sizeof(syntaxTables));
+
+  for (int c = 0; c < 256; c++) {
+    if (isSeparator(c))
+      tables->classes[c] |= CLASS_SEPARATOR;
+  }
+  for (int i = 0; syntax->operators[i]; i++)
+    tables->classes[(unsigned char)*syntax->operators[i]] |= CLASS_OPERATOR;
+  for (int i = 0; syntax->brackets[i]; i++)
+    tables->classes[(unsigned char)*syntax->brackets[i]] |= CLASS_BRACKET;
+  for (int i = 0; syntax->endStatements[i]; i++)
+    tables->classes[(unsigned char)*syntax->endStatements[i]] |= CLASS_END_STATEMENT;
+
+  int count = 0;
+  while (syntax->keywords[count])
+    count++;
+
+  syntaxKeyword *keywords = malloc(sizeof(syntaxKeyword) * (count + 1));
+  int unique = 0;
+
+  for (int i = 0; i < count; i++) {
+    char *value = syntax->keywords[i];
+    int length = strlen(value);
+    bool isDatatype = value[length - 1] == '|';
+    bool isPreprocessor = *value == '#';
+
+    if (isDatatype) length--;
+
+    int j = 0;
+    while (j < unique && (keywords[j].length != length || memcmp(keywords[j].value, value, length)))
+      j++;
+    if (j < unique) continue;
+
+    keywords[unique].value = value;
+    keywords[unique].length = length;
+    keywords[unique].token = isDatatype ? TOKEN_DATATYPE : isPreprocessor ? TOKEN_PREPROCESSOR : TOKEN_KEYWORD;
+    keywords[unique].isInclude = !strcmp(value, "#include");
+    tables->maxLength = max(tables->maxLength, length);
+    unique++;
+  }
+
+  // Seeds are tried until none of the keywords collide, with a bigger
+  // table every so often to make that likelier
+  tables->size = 4;
+  while (tables->size < 4 * (unsigned int)unique)
+    tables->size *= 2;
+  tables->keywords = malloc(sizeof(syntaxKeyword) * tables->size);
+
+  for (unsigned int seed = 2166136261u; !highlightHashKeywords(tables, keywords, unique, seed); seed++) {
+    if ((seed - 2166136261u) % 1024 == 1023) {
+      tables->size *= 2;
+      tables->keywords = realloc(tables->keywords, sizeof(syntaxKeyword) * tables->size);
     }
   }
-  return symbols[j] != NULL;
+
+  free(keywords);
+  syntax->tables = tables;
 }
 
-void editorUpdateHighlight(editorLine *line) {
-  line->highlight = realloc(line->highlight, sizeof(color_t) * line->renderLength);
-  colorLine(line, 0, theme.text.standard, line->renderLength);
+// Colors the line from where 'hc' stands up to render column 'end'; a
+// comment or include running to the end of the line is left in 'rest'
+void highlightRun(editorLine *line, highlightController *hc, int end) {
+  while (hc->idx < end) {
+    hc->prevHL = (hc->idx > 0) ? line->highlight[hc->idx - 1] : hc->prevHL;
+
+    bool wasHighlighted = (
+      highlightSinglelineComments(line, hc) ||
+      highlightMultilineComments(line, hc) ||
+      highlightStrings(line, hc) ||
+      highlightNumbers(line, hc) ||
+      highlightKeywords(line, hc) ||
+      highlightOperators(line, hc) ||
+      highlightBrackets(line, hc) ||
+      highlightEndStatemetns(line, hc)
+    );
 
-  if (E.syntax == NULL) return;
+    if (wasHighlighted) continue;
+
+    hc->isPrevSep = E.syntax->tables->classes[(unsigned char)line->renderContent[hc->idx]] & CLASS_SEPARATOR;
+    hc->idx++;
+  }
+}
+
+// Colors the line as if the lines above left it in the given comment state
+// and returns the state it leaves for the next one
+bool editorHighlightLine(editorLine *line, bool inComment) {
+  line->highlight = slabRealloc(line->highlight, line->renderLength);
+  colorLine(line, 0, TOKEN_TEXT, line->renderLength);
+
+  line->startsInComment = inComment;
+  line->isOpenComment = false;
+  line->isHighlighted = true;
+
+  if (E.syntax == NULL) return false;
 
   highlightController hc;
   hc.isPrevSep = true;
-  hc.inComment = line->index > 0 && E.lines[line->index - 1].isOpenComment;
+  hc.inComment = inComment;
   hc.inString = 0;
   hc.idx = 0;
+  hc.prevHL = TOKEN_TEXT;
+  hc.rest = TOKEN_TEXT;
 
-  while (hc.idx < line->renderLength) {
-    hc.prevHL = (hc.idx > 0) ? line->highlight[hc.idx - 1] : theme.text.standard;
+  highlightRun(line, &hc, line->renderLength);
 
-    bool wasHighlighted = (
-      highlightSinglelineComments(line, &hc) ||
-      highlightMultilineComments(line, &hc) ||
-      highlightStrings(line, &hc) ||
-      highlightNumbers(line, &hc) ||
-      highlightKeywords(line, &hc) ||
-      highlightOperators(line, &hc) ||
-      highlightBrackets(line, &hc) ||
-      highlightEndStatemetns(line, &hc)
-    );
+  line->isOpenComment = hc.inComment;
+  return hc.inComment;
+}
 
-    if (wasHighlighted) continue;
+// Colors a line for the comment state it starts in unless it already is,
+// and returns the state it leaves
+bool highlightLineFor(editorLine *line, bool inComment) {
+  if (line == E.gap.line)
+    return gapHighlight(inComment);
+
+  if (!line->isHighlighted || line->startsInComment != inComment)
+    editorHighlightLine(line, inComment);
+  return line->isOpenComment;
+}
+
+// Edited lines are only marked here; they and the lines below them are
+// colored again when they are about to be drawn
+void editorUpdateHighlight(editorLine *line) {
+  line->isHighlighted = false;
+  highlightInvalidate(line->index);
+}
+
+// Drops the checkpoints that depend on the contents of line 'at'
+void highlightInvalidate(int at) {
+  __atomic_add_fetch(&E.highlighter.generation, 1, __ATOMIC_RELEASE);
+
+  int keep = at / HIGHLIGHT_CHECKPOINT_INTERVAL + 1;
+
+  if (E.checkpoints.count > keep)
+    E.checkpoints.count = keep;
+}
+
+void highlightCheckpoint(int at, bool inComment) {
+  int checkpoint = at / HIGHLIGHT_CHECKPOINT_INTERVAL;
+
+  if (at % HIGHLIGHT_CHECKPOINT_INTERVAL || checkpoint != E.checkpoints.count)
+    return;
 
-    hc.isPrevSep = isSeparator(line->renderContent[hc.idx]);
-    hc.idx++;
+  if (E.checkpoints.count == E.checkpoints.capacity) {
+    E.checkpoints.capacity = E.checkpoints.capacity ? 2 * E.checkpoints.capacity : 64;
+    E.checkpoints.states = realloc(E.checkpoints.states, sizeof(bool) * E.checkpoints.capacity);
   }
+  E.checkpoints.states[E.checkpoints.count++] = inComment;
+}
 
-  bool changed = line->isOpenComment != hc.inComment;
-  bool isLastLine = line->index + 1 >= E.numlines;
-  line->isOpenComment = hc.inComment;
+bool highlightContains(char *content, int length, struct comment delimiter) {
+  if (!delimiter.length) return false;
+
+  char *end = content + length;
+  for (char *c = content; (c = memchr(c, *delimiter.value, end - c)); c++) {
+    if (end - c >= delimiter.length && !memcmp(c, delimiter.value, delimiter.length))
+      return true;
+  }
+  return false;
+}
+
+// Returns the comment state a line of raw text ends with, using 'scratch'
+// to run it through the highlighter; tabs make no difference to the state
+bool highlightTextState(char *content, int length, bool inComment, editorLine *scratch) {
+  // Only the delimiter that closes or opens a comment can change the state
+  struct comment delimiter = inComment
+    ? E.syntax->comment.multiline.end
+    : E.syntax->comment.multiline.start;
+
+  if (!highlightContains(content, length, delimiter))
+    return inComment;
+
+  editorDropRender(scratch);
+  scratch->content = slabRealloc(scratch->content, length + 1);
+  memcpy(scratch->content, content, length);
+  scratch->content[length] = '\0';
+  scratch->length = length;
+  scratch->renderContent = scratch->content;
+  scratch->renderLength = length;
+
+  return editorHighlightLine(scratch, inComment);
+}
+
+// Holds lines that are not loaded while their state is worked out
+static editorLine stateScratch;
+
+void highlightFreeScratch(void) {
+  editorFreeLine(&stateScratch);
+  memset(&stateScratch, 0, sizeof(editorLine));
+}
+
+// Returns the comment state line 'at' ends with when it starts in 'inComment'
+bool highlightLineState(int at, bool inComment) {
+  editorLine *line = editorPeekLine(at);
+
+  if (line)
+    return highlightLineFor(line, inComment);
+
+  // Lines that are not loaded are not brought in just for their state
+  int offset;
+  linePiece *piece = piecesFind(at, &offset);
+
+  int length;
+  char *content = originalLineContent(piece->start + offset, &length);
+
+  return highlightTextState(content, length, inComment, &stateScratch);
+}
+
+// Returns the comment state line 'at' starts in, walking from the closest
+// checkpoint above it and recording the ones passed on the way
+bool highlightStateAt(int at) {
+  if (E.syntax == NULL) return false;
+
+  int checkpoint = min(at / HIGHLIGHT_CHECKPOINT_INTERVAL, E.checkpoints.count - 1);
+  int row = checkpoint < 0 ? 0 : checkpoint * HIGHLIGHT_CHECKPOINT_INTERVAL;
+  bool inComment = checkpoint < 0 ? false : E.checkpoints.states[checkpoint];
 
-  if (changed && !isLastLine) {
-    editorUpdateHighlight(&E.lines[line->index + 1]);
+  for (; row < at; row++) {
+    highlightCheckpoint(row, inComment);
+    inComment = highlightLineState(row, inComment);
+  }
+
+  highlightCheckpoint(at, inComment);
+  return inComment;
+}
+
+// Gives a line that waits for the highlighter thread uncolored text
+void highlightPlain(editorLine *line) {
+  line->highlight = slabRealloc(line->highlight, line->renderLength);
+  colorLine(line, 0, TOKEN_TEXT, line->renderLength);
+}
+
+// Makes sure lines [first, last) are colored for the state they start in
+void editorHighlightRows(int first, int last) {
+  last = min(last, E.numlines);
+  if (first >= last) return;
+
+  bool inComment = highlightStateAt(first);
+
+  for (int row = first; row < last; row++) {
+    highlightCheckpoint(row, inComment);
+    inComment = highlightLineFor(editorViewLine(row), inComment);
   }
 }
 
 void editorSelectSyntaxHighlight(void) {
+  highlighterCancel();
+
   E.syntax = NULL;
+  E.checkpoints.count = 0;
+
+  for (int k = 0; k < E.numlines; k++) {
+    editorLine *line = editorPeekLine(k);
+    if (line) line->isHighlighted = false;
+  }
 
   if (E.filename == NULL) return;
 
@@ -220,11 +461,6 @@ void editorSelectSyntaxHighlight(void) {
       if ((isExtension && extension && !strcmp(extension, syntax->filematch[j])) || 
           (!isExtension && strstr(E.filename, syntax->filematch[j]))) {
         E.syntax = syntax;
-
-        for (int k = 0; k < E.numlines; k++) {
-          editorUpdateHighlight(&E.lines[k]);
-        }
-
         return;
       }
     }
@@ -235,8 +471,10 @@ void clearSearchHighlight(void) {
   int cur = E.rowOffset;
   int last = min(cur + E.screenRows, E.numlines);
   while (cur < last) {
-    editorUpdateHighlight(&E.lines[cur]);
+    editorGetLine(cur)->isHighlighted = false;
     cur++; 
   }
+
+  editorHighlightRows(E.rowOffset, last);
 }
 
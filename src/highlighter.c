@@ -0,0 +1,285 @@
+#include <gap.h>
+#include <highlight.h>
+#include <highlighter.h>
+#include <lines.h>
+#include <pieces.h>
+#include <slab.h>
+#include <tools.h>
+
+void highlighterFreeJob(highlightJob *job) {
+  if (job == NULL) return;
+
+  for (int i = 0; i < job->numsegments; i++) {
+    if (job->segments[i].isCopy)
+      free(job->segments[i].content);
+  }
+  free(job->segments);
+  free(job);
+}
+
+void highlighterFreeResult(highlightResult *result) {
+  if (result == NULL) return;
+
+  for (int i = 0; i < result->to - result->from; i++)
+    slabFree(result->lines[i].highlight);
+  free(result->lines);
+  free(result->checkpoints);
+  free(result);
+}
+
+void highlighterAddSegment(highlightJob *job, char *content, size_t length, int count, bool isCopy) {
+  job->segments = realloc(job->segments, sizeof(highlightSegment) * (job->numsegments + 1));
+  job->segments[job->numsegments++] = (highlightSegment){content, length, count, isCopy};
+}
+
+// Colors the lines of a job, giving up as soon as the text it was taken
+// from changes; runs on the highlighter thread and only reads the job
+highlightResult *highlighterRun(highlightJob *job) {
+  highlightResult *result = malloc(sizeof(highlightResult));
+  result->generation = job->generation;
+  result->first = job->first;
+  result->checkpoints = malloc(sizeof(bool) * ((job->to - job->first) / HIGHLIGHT_CHECKPOINT_INTERVAL + 1));
+  result->numcheckpoints = 0;
+  result->from = job->from;
+  result->to = job->to;
+  result->lines = calloc(job->to - job->from, sizeof(highlightedLine));
+
+  editorLine scratch;
+  memset(&scratch, 0, sizeof(editorLine));
+
+  bool inComment = job->inComment;
+  int row = job->first;
+
+  for (int i = 0; i < job->numsegments && result; i++) {
+    highlightSegment *segment = &job->segments[i];
+    char *content = segment->content;
+    char *end = content + segment->length;
+
+    for (int j = 0; j < segment->count; j++, row++) {
+      if (__atomic_load_n(&E.highlighter.generation, __ATOMIC_ACQUIRE) != job->generation) {
+        highlighterFreeResult(result);
+        result = NULL;
+        break;
+      }
+
+      char *newline = segment->isCopy ? NULL : memchr(content, LINE_FEED, end - content);
+      int length = (newline ? newline : end) - content;
+
+      while (!segment->isCopy && length > 0 && content[length - 1] == RETURN)
+        length--;
+
+      if (row % HIGHLIGHT_CHECKPOINT_INTERVAL == 0)
+        result->checkpoints[result->numcheckpoints++] = inComment;
+
+      if (row < job->from) {
+        inComment = highlightTextState(content, length, inComment, &scratch);
+      }
+      else {
+        // Lines of the original file do not end in a terminator
+        scratch.content = slabRealloc(scratch.content, length + 1);
+        memcpy(scratch.content, content, length);
+        scratch.content[length] = '\0';
+        scratch.length = length;
+        editorRenderLine(&scratch, editorCountTabs(&scratch));
+        inComment = editorHighlightLine(&scratch, inComment);
+
+        highlightedLine *line = &result->lines[row - job->from];
+        line->highlight = scratch.highlight;
+        line->renderLength = scratch.renderLength;
+        line->startsInComment = scratch.startsInComment;
+        line->isOpenComment = inComment;
+        scratch.highlight = NULL;
+      }
+
+      content = newline ? newline + 1 : end;
+    }
+  }
+
+  editorFreeLine(&scratch);
+  return result;
+}
+
+void *highlighterThread(void *arg) {
+  (void)arg;
+
+  pthread_mutex_lock(&E.highlighter.lock);
+  while (true) {
+    while (E.highlighter.job == NULL)
+      pthread_cond_wait(&E.highlighter.wake, &E.highlighter.lock);
+
+    highlightJob *job = E.highlighter.job;
+    E.highlighter.job = NULL;
+    E.highlighter.isBusy = true;
+    pthread_mutex_unlock(&E.highlighter.lock);
+
+    highlightResult *result = highlighterRun(job);
+    highlighterFreeJob(job);
+
+    // The drawing side takes results without ever waiting on this thread;
+    // one it has not picked up yet is simply replaced by the newer one
+    if (result) {
+      highlighterFreeResult(__atomic_exchange_n(&E.highlighter.result, result, __ATOMIC_ACQ_REL));
+      write(E.wakeup[1], "h", 1);
+    }
+
+    pthread_mutex_lock(&E.highlighter.lock);
+    E.highlighter.isBusy = false;
+    pthread_cond_broadcast(&E.highlighter.idle);
+  }
+
+  return NULL;
+}
+
+void highlighterStart(void) {
+  E.highlighter.isBusy = false;
+  E.highlighter.job = NULL;
+  E.highlighter.result = NULL;
+  E.highlighter.generation = 0;
+  E.highlighter.posted.generation = 0;
+  E.highlighter.posted.from = E.highlighter.posted.to = 0;
+
+  pthread_mutex_init(&E.highlighter.lock, NULL);
+  pthread_cond_init(&E.highlighter.wake, NULL);
+  pthread_cond_init(&E.highlighter.idle, NULL);
+
+  // Without the thread every line is simply highlighted before it is drawn
+  E.highlighter.isRunning = pthread_create(&E.highlighter.thread, NULL, highlighterThread, NULL) == 0;
+}
+
+// Hands lines [from, to) to the highlighter thread, along with the lines
+// between them and the closest checkpoint above
+void highlighterPost(int from, int to) {
+  unsigned int generation = E.highlighter.generation;
+
+  if (E.highlighter.posted.generation == generation && E.highlighter.posted.from == from && E.highlighter.posted.to == to)
+    return;
+
+  int checkpoint = min(from / HIGHLIGHT_CHECKPOINT_INTERVAL, E.checkpoints.count - 1);
+
+  highlightJob *job = malloc(sizeof(highlightJob));
+  job->generation = generation;
+  job->first = checkpoint < 0 ? 0 : checkpoint * HIGHLIGHT_CHECKPOINT_INTERVAL;
+  job->inComment = checkpoint < 0 ? false : E.checkpoints.states[checkpoint];
+  job->from = from;
+  job->to = to;
+  job->segments = NULL;
+  job->numsegments = 0;
+
+  // Lines of the original file are passed as they are laid out in the
+  // buffer, which stays mapped until the thread is done; the others are copied
+  int row = job->first;
+  while (row < to) {
+    int offset;
+    linePiece *piece = piecesFind(row, &offset);
+    int count = min(piece->count - offset, to - row);
+
+    if (piece->isOriginal) {
+      size_t length;
+      char *content = originalLinesContent(piece->start + offset, count, &length);
+      highlighterAddSegment(job, content, length, count, false);
+    }
+    else {
+      for (int i = 0; i < count; i++) {
+        editorLine *line = addedLine(piece->start + offset + i);
+        char *content = malloc(line->length + 1);
+
+        if (line == E.gap.line)
+          gapCopy(content);
+        else
+          memcpy(content, line->content, line->length);
+        highlighterAddSegment(job, content, line->length, 1, true);
+      }
+    }
+    row += count;
+  }
+
+  pthread_mutex_lock(&E.highlighter.lock);
+  highlighterFreeJob(E.highlighter.job);
+  E.highlighter.job = job;
+  pthread_cond_signal(&E.highlighter.wake);
+  pthread_mutex_unlock(&E.highlighter.lock);
+
+  E.highlighter.posted.generation = generation;
+  E.highlighter.posted.from = from;
+  E.highlighter.posted.to = to;
+}
+
+// Drops pending work and finished results, and waits for the thread to
+// let go of the buffer
+void highlighterCancel(void) {
+  __atomic_add_fetch(&E.highlighter.generation, 1, __ATOMIC_RELEASE);
+
+  if (!E.highlighter.isRunning) return;
+
+  pthread_mutex_lock(&E.highlighter.lock);
+  highlighterFreeJob(E.highlighter.job);
+  E.highlighter.job = NULL;
+
+  while (E.highlighter.isBusy)
+    pthread_cond_wait(&E.highlighter.idle, &E.highlighter.lock);
+  pthread_mutex_unlock(&E.highlighter.lock);
+
+  highlighterFreeResult(__atomic_exchange_n(&E.highlighter.result, NULL, __ATOMIC_ACQ_REL));
+}
+
+// Takes in the colors and checkpoints of a finished job, unless the text
+// changed since it was posted
+void highlighterAdopt(void) {
+  highlightResult *result = __atomic_exchange_n(&E.highlighter.result, NULL, __ATOMIC_ACQ_REL);
+
+  if (result == NULL) return;
+
+  if (result->generation == E.highlighter.generation) {
+    for (int i = 0; i < result->numcheckpoints; i++)
+      highlightCheckpoint(result->first + i * HIGHLIGHT_CHECKPOINT_INTERVAL, result->checkpoints[i]);
+
+    for (int row = result->from; row < result->to && row < E.numlines; row++) {
+      highlightedLine *ready = &result->lines[row - result->from];
+
+      // The line being typed into is only colored as far as it is shown,
+      // from the state the job found it to start in
+      if (E.gap.line && E.gap.row == row) {
+        if (!E.gap.line->isHighlighted)
+          gapHighlight(ready->startsInComment);
+        continue;
+      }
+
+      editorLine *line = editorViewLine(row);
+
+      if (line->isHighlighted || line->renderLength != ready->renderLength)
+        continue;
+
+      slabFree(line->highlight);
+      line->highlight = ready->highlight;
+      line->startsInComment = ready->startsInComment;
+      line->isOpenComment = ready->isOpenComment;
+      line->isHighlighted = true;
+      ready->highlight = NULL;
+    }
+  }
+
+  highlighterFreeResult(result);
+}
+
+void editorHighlightViewport(void) {
+  int first = E.rowOffset;
+  int last = min(E.rowOffset + E.screenRows + HIGHLIGHT_LOOKAHEAD, E.numlines);
+
+  highlighterAdopt();
+
+  // Rows close enough to a known state are colored right away
+  int known = max(0, E.checkpoints.count - 1) * HIGHLIGHT_CHECKPOINT_INTERVAL;
+
+  if (!E.highlighter.isRunning || E.syntax == NULL || first - known <= HIGHLIGHT_SYNC_LINES) {
+    editorHighlightRows(first, last);
+    return;
+  }
+
+  highlighterPost(max(0, first - E.screenRows), min(last + E.screenRows, E.numlines));
+
+  for (int row = first; row < last; row++) {
+    editorLine *line = editorViewLine(row);
+    if (!line->isHighlighted)
+      highlightPlain(line);
+  }
+}
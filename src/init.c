@@ -1,12 +1,36 @@
+#include <highlight.h>
+#include <highlighter.h>
 #include <init.h>
+#include <journal.h>
 #include <lines.h>
+#include <output.h>
+#include <saver.h>
+#include <searcher.h>
+#include <slab.h>
 #include <terminal.h>
 #include <tools.h>
+#include <undo.h>
 
 #define COLOR_RGB(r, g, b, isBg) (color_t){r, g, b, isBg, isDark(r, g, b)}
 
 editorConfig E;
 colors theme;
+colorSequence colorCache[COLOR_CACHE_SIZE];
+
+color_t *palette[TOKEN_COUNT] = {
+  [TOKEN_TEXT] = &theme.text.standard,
+  [TOKEN_KEYWORD] = &theme.keyword,
+  [TOKEN_DATATYPE] = &theme.datatype,
+  [TOKEN_PREPROCESSOR] = &theme.preprocessor,
+  [TOKEN_NUMBER] = &theme.number,
+  [TOKEN_STRING] = &theme.string,
+  [TOKEN_COMMENT] = &theme.comment,
+  [TOKEN_OPERATOR] = &theme.operators,
+  [TOKEN_BRACKET] = &theme.brackets,
+  [TOKEN_END_STATEMENT] = &theme.endStatement,
+  [TOKEN_MATCH] = &theme.match.unselected,
+  [TOKEN_SELECTED_MATCH] = &theme.match.selected
+};
 
 char *C_EXTENSIONS[] = {".c", ".cpp", ".h", NULL};
 char *C_KEYWORDS[] = {
@@ -30,7 +54,8 @@ editorSyntax HLDB[] = {
     C_BRACKETS,
     C_END_STATEMENTS,
     HIGHLIGHT_NUMBERS | HIGHLIGHT_STRINGS,
-    { {"//", 2}, { {"/*", 2}, {"*/", 2} } }
+    { {"//", 2}, { {"/*", 2}, {"*/", 2} } },
+    NULL
   }
 };
 
@@ -47,19 +72,60 @@ void initEditor(void) {
   E.colOffset = 0;
   E.numlines = 0;
   E.sidebarWidth = MIN_SIDEBAR_WIDTH;
-  E.lines = NULL;
+  E.pieces = NULL;
+  E.original.content = NULL;
+  E.original.length = 0;
+  E.original.indexed = 0;
+  memset(&E.original.index, 0, sizeof(lineIndex));
+  memset(&E.original.indexer.index, 0, sizeof(lineIndex));
+  E.original.isMapped = false;
+  E.original.indexer.isRunning = false;
+  E.added.blocks = NULL;
+  E.added.numblocks = 0;
+  E.added.size = 0;
+  E.added.freed = NULL;
+  E.added.numfreed = 0;
+  E.checkpoints.states = NULL;
+  E.checkpoints.count = 0;
+  E.checkpoints.capacity = 0;
+  E.screen.front = E.screen.back = NULL;
+  E.screen.rows = E.screen.cols = 0;
+  E.screen.isValid = false;
+  E.screen.output = (buffer)BUFFER_INIT;
+  E.screen.pen.hasFg = E.screen.pen.hasBg = false;
+  E.screen.pen.isBold = false;
   E.mode = NORMAL;
   E.dirty = false;
+  E.changes = 0;
   E.splashScreen = false;
   E.isPromptOpen = false;
+  E.isPrompting = false;
+  E.isMessageShown = false;
+  E.input.start = E.input.end = 0;
+  E.input.fd = E.batch.isRunning ? E.batch.fd : STDIN_FILENO;
+  E.gap.line = NULL;
+  undoInit();
   E.filename = NULL;
   E.statusmsg[0] = '\0';
   E.syntax = NULL;
 
-  if (!getWindowSize(&E.screenRows, &E.screenCols))
+  // Background threads and signals write to this pipe to wake up the
+  // input loop
+  if (pipe(E.wakeup) == -1)
+    die("pipe");
+  fcntl(E.wakeup[0], F_SETFL, O_NONBLOCK);
+  fcntl(E.wakeup[1], F_SETFL, O_NONBLOCK);
+
+  slabInit();
+  highlighterStart();
+  journalStart();
+  saverStart();
+  searcherStart();
+
+  if (!editorUpdateWindowSize())
     die("getWindowSize");
 
-  E.screenRows -= 1;
+  watchWindowSize();
 }
 
 void initColors(void) {
@@ -88,5 +154,16 @@ void initColors(void) {
   theme.text.standard = theme.background.isDark ? theme.text.light : theme.text.dark;
   theme.sidebar.number = COLOR_RGB(69, 71, 90, false);
   theme.sidebar.activeNumber = COLOR_RGB(180, 190, 254, false);
+
+  // The theme is made of colors only, whose escape sequences are all
+  // encoded up front
+  color_t *colors = (color_t *)&theme;
+  for (size_t i = 0; i < sizeof(theme) / sizeof(color_t); i++)
+    colorSequenceFor(colors[i]);
 }
 
+
+void initHighlightDataBase(void) {
+  for (size_t i = 0; i < HLDB_ENTRIES; i++)
+    highlightCompileSyntax(&HLDB[i]);
+}
@@ -1,11 +1,15 @@
+#include <batch.h>
 #include <editor.h>
 #include <fileio.h>
 #include <finder.h>
 #include <input.h>
+#include <journal.h>
 #include <keystrokes.h>
+#include <lines.h>
 #include <output.h>
 #include <terminal.h>
 #include <tools.h>
+#include <undo.h>
 
 char *editorPrompt(char *prompt, bool (*callback)(char *, int)) {
   // Used only in search
@@ -20,6 +24,8 @@ char *editorPrompt(char *prompt, bool (*callback)(char *, int)) {
   size_t buflen = 0;
   *buf = '\0';
 
+  E.isPrompting = true;
+
   while (true) {
     editorSetStatusMessage(prompt, buf);
     editorRefreshScreen();
@@ -42,6 +48,7 @@ char *editorPrompt(char *prompt, bool (*callback)(char *, int)) {
       free(buf);
 
       E.isPromptOpen = false;
+      E.isPrompting = false;
       return NULL;
     }
     else if (c == RETURN) {
@@ -49,8 +56,25 @@ char *editorPrompt(char *prompt, bool (*callback)(char *, int)) {
       if (callback) callback(buf, c);
 
       E.isPromptOpen = false;
+      E.isPrompting = false;
       return buf;
     }
+    else if (c == PASTE_START) {
+      size_t length;
+      char *paste = editorReadPaste(&length);
+
+      for (size_t i = 0; i < length; i++) {
+        if (iscntrl((unsigned char)paste[i]) || (unsigned char)paste[i] >= 128) continue;
+
+        if (buflen == bufsize - 1) {
+          bufsize *= 2;
+          buf = realloc(buf, bufsize);
+        }
+        buf[buflen++] = paste[i];
+      }
+      buf[buflen] = '\0';
+      free(paste);
+    }
     else if (!iscntrl(c) && c < 128) {
       if (buflen == bufsize - 1) {
         bufsize *= 2;
@@ -72,11 +96,11 @@ char *editorPrompt(char *prompt, bool (*callback)(char *, int)) {
 void refreshPromptCursor(void) {
   char temp[32];
   snprintf(temp, sizeof(temp), "\x1b[%d;%luH", E.rowOffset + E.screenRows + 2, strlen(E.statusmsg) + 1);
-  write(STDOUT_FILENO, temp, strlen(temp));
+  terminalWrite(temp, strlen(temp));
 }
 
 void editorMoveCursor(int key) {
-  editorLine *currentLine = &E.lines[E.cursorY];
+  int length = editorLineLength(E.cursorY);
 
   switch (key) {
     case ARROW_UP:
@@ -99,13 +123,13 @@ void editorMoveCursor(int key) {
       }
       else if (E.cursorY > 0) {
         E.cursorY--;
-        E.cursorX = max(0, E.lines[E.cursorY].length + (E.mode == NORMAL ? -1 : 0));;
+        E.cursorX = max(0, editorLineLength(E.cursorY) + (E.mode == NORMAL ? -1 : 0));
       }
       E.highestLastX = E.cursorX;
       break;
 
     case ARROW_RIGHT: {
-      int cursorLimit = currentLine->length + (E.mode == NORMAL ? -1 : 0);
+      int cursorLimit = length + (E.mode == NORMAL ? -1 : 0);
       if (E.cursorX < cursorLimit) {
         E.cursorX++;
       }
@@ -126,6 +150,11 @@ void editorProcessKeypress(void) {
 
   int c = editorReadKey();
 
+  // Each command in normal mode is undone on its own, along with whatever
+  // is typed in the insert mode it leads to
+  if (E.mode == NORMAL)
+    undoBreak();
+
   switch (c) {
     case ARROW_UP:
     case ARROW_DOWN:
@@ -134,6 +163,13 @@ void editorProcessKeypress(void) {
       editorMoveCursor(c);
       return;
 
+    case PASTE_START:
+      editorPaste();
+      return;
+
+    case PASTE_END:
+      return;
+
     case HOME_KEY:
       E.cursorX = 0;
       return;
@@ -159,7 +195,11 @@ void editorProcessKeypress(void) {
         editorSetStatusMessage("File has unsaved changes. Press Ctrl-Q again to quit");
         return;
       }
-      write(STDOUT_FILENO, "\x1b[H", 3);  // Moves cursor to home position (0, 0)
+      if (E.batch.isRunning)
+        batchFinish();
+
+      journalDiscard();
+      terminalWrite("\x1b[H", 3);  // Moves cursor to home position (0, 0)
       system(CLEAR);
       exit(0);
       return;
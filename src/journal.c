@@ -0,0 +1,407 @@
+#define _DEFAULT_SOURCE
+
+#include <buffer.h>
+#include <journal.h>
+#include <lines.h>
+#include <output.h>
+#include <sys/stat.h>
+#include <tools.h>
+#include <undo.h>
+
+// Changes made since the last save are appended to a journal next to the
+// file, from which they are played back when the file is opened after the
+// editor went away without saving. The editor only copies each change to
+// a buffer; a thread writes out what piled up and syncs it to disk every
+// JOURNAL_SYNC_INTERVAL milliseconds
+
+static const char journalMagic[8] = {'k', 'i', 'l', 'o', 'j', 'n', 'l', '1'};
+
+// Turns "dir/name" into "dir/.name.journal"
+char *journalPath(const char *filename) {
+  const char *slash = strrchr(filename, '/');
+  int dirLength = slash ? slash - filename + 1 : 0;
+
+  char *path = malloc(strlen(filename) + strlen(JOURNAL_SUFFIX) + 2);
+  sprintf(path, "%.*s.%s%s", dirLength, filename, filename + dirLength, JOURNAL_SUFFIX);
+  return path;
+}
+
+void journalWriteAll(int fd, char *content, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, content, length);
+    if (written == -1 && errno == EINTR) continue;
+    if (written <= 0) return;
+
+    content += written;
+    length -= written;
+  }
+}
+
+// Writes out the changes piled up so far, without holding up the editor
+// while they reach the disk
+void journalFlush(void) {
+  pthread_mutex_lock(&E.journal.lock);
+
+  if (E.journal.fd == -1 || E.journal.pending.length == 0) {
+    pthread_mutex_unlock(&E.journal.lock);
+    return;
+  }
+
+  buffer batch = E.journal.pending;
+  int fd = E.journal.fd;
+  E.journal.pending = (buffer)BUFFER_INIT;
+  E.journal.isBusy = true;
+  pthread_mutex_unlock(&E.journal.lock);
+
+  journalWriteAll(fd, batch.content, batch.length);
+  fdatasync(fd);
+  freeBuffer(&batch);
+
+  pthread_mutex_lock(&E.journal.lock);
+  E.journal.isBusy = false;
+  pthread_cond_broadcast(&E.journal.idle);
+  pthread_mutex_unlock(&E.journal.lock);
+}
+
+void *journalThread(void *arg) {
+  (void)arg;
+
+  struct timespec interval = {
+    JOURNAL_SYNC_INTERVAL / 1000,
+    (JOURNAL_SYNC_INTERVAL % 1000) * 1000000L
+  };
+
+  while (true) {
+    nanosleep(&interval, NULL);
+    journalFlush();
+  }
+
+  return NULL;
+}
+
+void journalStart(void) {
+  E.journal.path = NULL;
+  E.journal.fd = -1;
+  E.journal.pending = (buffer)BUFFER_INIT;
+  E.journal.size = 0;
+  E.journal.isBusy = false;
+
+  pthread_mutex_init(&E.journal.lock, NULL);
+  pthread_cond_init(&E.journal.idle, NULL);
+
+  // A batch run keeps no journal, so a script neither picks up the changes
+  // of a session that went away nor leaves its own behind
+  if (E.batch.isRunning) {
+    E.journal.isRunning = false;
+    return;
+  }
+
+  // Without the thread the journal is written as changes are made
+  E.journal.isRunning = pthread_create(&E.journal.thread, NULL, journalThread, NULL) == 0;
+}
+
+// Creates the journal for the file as it is on disk now
+void journalCreate(void) {
+  struct stat st;
+  if (stat(E.filename, &st) == -1) return;
+
+  int fd = open(E.journal.path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+  if (fd == -1) return;
+
+  journalHeader header;
+  memcpy(header.magic, journalMagic, sizeof(header.magic));
+  header.size = st.st_size;
+  header.mtime = st.st_mtim.tv_sec;
+  header.mtimeNsec = st.st_mtim.tv_nsec;
+  journalWriteAll(fd, (char *)&header, sizeof(header));
+
+  pthread_mutex_lock(&E.journal.lock);
+  E.journal.fd = fd;
+  E.journal.size = sizeof(header);
+  pthread_mutex_unlock(&E.journal.lock);
+}
+
+void journalAppend(int kind, int row, int col, int count, const char *text, size_t length) {
+  if (E.journal.path == NULL || E.batch.isRunning) return;
+
+  if (E.journal.fd == -1)
+    journalCreate();
+  if (E.journal.fd == -1) return;
+
+  journalEntry entry = {
+    row, col, count,
+    E.undo.cursorX, E.undo.cursorY,
+    length, kind, E.undo.isBroken, {0, 0}
+  };
+
+  pthread_mutex_lock(&E.journal.lock);
+  appendBuffer(&E.journal.pending, (char *)&entry, sizeof(entry));
+  if (length) appendBuffer(&E.journal.pending, text, length);
+  E.journal.size += sizeof(entry) + length;
+  pthread_mutex_unlock(&E.journal.lock);
+
+  if (!E.journal.isRunning)
+    journalFlush();
+}
+
+// Makes a change read from the journal, unless it does not fit the text
+bool journalApply(journalEntry *entry, char *text) {
+  if (entry->kind == JOURNAL_UNDO) {
+    editorUndo();
+    return true;
+  }
+
+  if (entry->kind == JOURNAL_REDO) {
+    editorRedo();
+    return true;
+  }
+
+  bool isText = entry->kind == UNDO_INSERT_TEXT || entry->kind == UNDO_DELETE_TEXT;
+
+  if (entry->kind > UNDO_DELETE_LINES || entry->row < 0 || entry->row > E.numlines - isText)
+    return false;
+
+  // A torn or stale journal can still name lines or columns that are not
+  // there, which the change would reach past
+  if (entry->kind == UNDO_DELETE_LINES && (entry->count < 1 || entry->row + entry->count > E.numlines))
+    return false;
+
+  if (isText) {
+    if (entry->col < 0) return false;
+
+    size_t end = (size_t)entry->col + (entry->kind == UNDO_DELETE_TEXT ? entry->length : 0);
+    if (end > (size_t)editorLineLength(entry->row))
+      return false;
+  }
+
+  // The change is logged again just as it was first made
+  E.undo.isBroken = entry->isBroken;
+  E.undo.cursorX = entry->cursorX;
+  E.undo.cursorY = entry->cursorY;
+
+  undoRecord record = {
+    entry->kind, false, entry->row, entry->col, entry->count, -1,
+    0, 0, text, entry->length, entry->length
+  };
+  undoApply(&record, false);
+
+  E.cursorY = entry->row;
+  E.cursorX = entry->col;
+  return true;
+}
+
+// Typing or deleting along a line leaves an entry per character, which the
+// undo log merged into one record; the same runs are made in one go here
+bool journalExtends(journalEntry *run, journalEntry *entry, buffer *text, char *more) {
+  if (entry->isBroken || entry->kind != run->kind || entry->row != run->row)
+    return false;
+
+  if (run->kind == UNDO_INSERT_TEXT && (size_t)entry->col == run->col + run->length) {
+    appendBuffer(text, more, entry->length);
+  }
+  else if (run->kind == UNDO_DELETE_TEXT && entry->col == run->col) {
+    appendBuffer(text, more, entry->length);
+  }
+  else if (run->kind == UNDO_DELETE_TEXT && entry->col + entry->length == (size_t)run->col) {
+    extendBuffer(text, entry->length);
+    memmove(&text->content[entry->length], text->content, run->length);
+    memcpy(text->content, more, entry->length);
+    run->col = entry->col;
+  }
+  else {
+    return false;
+  }
+
+  run->length += entry->length;
+  return true;
+}
+
+// Plays back the changes of a journal onto the file just loaded and
+// returns how many there were, or -1 when it was made for another
+// version of the file
+int journalReplay(int fd) {
+  struct stat journal, file;
+  if (fstat(fd, &journal) == -1 || stat(E.filename, &file) == -1)
+    return -1;
+
+  size_t size = journal.st_size;
+  char *content = malloc(size + 1);
+  size_t length = 0;
+  ssize_t n;
+
+  while (length < size && (n = read(fd, content + length, size - length)) > 0)
+    length += n;
+
+  journalHeader header;
+  if (length < sizeof(header)) {
+    free(content);
+    return -1;
+  }
+  memcpy(&header, content, sizeof(header));
+
+  if (memcmp(header.magic, journalMagic, sizeof(header.magic)) != 0 ||
+      header.size != file.st_size ||
+      header.mtime != file.st_mtim.tv_sec ||
+      header.mtimeNsec != file.st_mtim.tv_nsec) {
+    free(content);
+    return -1;
+  }
+
+  // Changes may have been made anywhere in the file
+  editorLoadIndexedLines();
+
+  size_t at = sizeof(header);
+  size_t runStart = at;
+  int count = 0, runCount = 0;
+  journalEntry run;
+  buffer text = BUFFER_INIT;
+
+  while (true) {
+    journalEntry entry;
+    bool isWhole = length - at >= sizeof(entry);
+
+    if (isWhole) {
+      memcpy(&entry, content + at, sizeof(entry));
+      isWhole = entry.length <= length - at - sizeof(entry);
+    }
+
+    char *more = content + at + sizeof(entry);
+    if (isWhole && runCount && journalExtends(&run, &entry, &text, more)) {
+      at += sizeof(entry) + entry.length;
+      runCount++;
+      continue;
+    }
+
+    if (runCount) {
+      if (!journalApply(&run, text.content)) {
+        at = runStart;
+        break;
+      }
+      count += runCount;
+      runCount = 0;
+    }
+
+    if (!isWhole) break;
+
+    runStart = at;
+    run = entry;
+    text.length = 0;
+    appendBuffer(&text, more, entry.length);
+    at += sizeof(entry) + entry.length;
+    runCount = 1;
+  }
+
+  freeBuffer(&text);
+
+  // Whatever the editor was cut off in the middle of writing is dropped
+  if (at < length)
+    ftruncate(fd, at);
+  E.journal.size = at;
+
+  free(content);
+  return count;
+}
+
+// Picks up where an editor that went away left the file, before journaling
+// the changes made from here on
+void journalOpen(void) {
+  if (E.batch.isRunning) return;
+
+  char *path = journalPath(E.filename);
+  int fd = open(path, O_RDWR | O_APPEND);
+
+  if (fd != -1) {
+    int count = journalReplay(fd);
+
+    if (count < 0) {
+      close(fd);
+      editorSetStatusMessage("%s was made for another version of the file and is ignored", path);
+    }
+    else {
+      E.journal.fd = fd;
+
+      if (count > 0) {
+        E.cursorY = clamp(0, E.cursorY, E.numlines - 1);
+        fixCursorXPosition();
+        E.highestLastX = E.cursorX;
+        E.dirty = true;
+        undoBreak();
+        editorSetStatusMessage("Recovered %d changes from %s", count, path);
+      }
+    }
+  }
+
+  E.journal.path = path;
+}
+
+// Drops the journal once its changes are saved or abandoned
+void journalDiscard(void) {
+  if (E.batch.isRunning) return;
+
+  if (E.journal.path == NULL) {
+    if (E.filename) E.journal.path = journalPath(E.filename);
+    return;
+  }
+
+  pthread_mutex_lock(&E.journal.lock);
+  while (E.journal.isBusy)
+    pthread_cond_wait(&E.journal.idle, &E.journal.lock);
+
+  E.journal.pending.length = 0;
+  E.journal.size = 0;
+
+  if (E.journal.fd != -1) {
+    close(E.journal.fd);
+    unlink(E.journal.path);
+    E.journal.fd = -1;
+  }
+  pthread_mutex_unlock(&E.journal.lock);
+}
+
+// Tells where the changes made from now on start in the journal
+size_t journalMark(void) {
+  return E.journal.fd == -1 ? sizeof(journalHeader) : E.journal.size;
+}
+
+// Starts the journal over for the version of the file just saved, keeping
+// the changes made after 'mark' while it was being written
+void journalRebase(size_t mark) {
+  if (E.journal.path == NULL || E.journal.fd == -1) {
+    journalDiscard();
+    return;
+  }
+
+  pthread_mutex_lock(&E.journal.lock);
+  while (E.journal.isBusy)
+    pthread_cond_wait(&E.journal.idle, &E.journal.lock);
+
+  // The changes after the mark are either on disk or still pending
+  size_t written = E.journal.size - E.journal.pending.length;
+  buffer changes = BUFFER_INIT;
+
+  if (mark < written) {
+    char *at = extendBuffer(&changes, written - mark);
+    if (pread(E.journal.fd, at, written - mark, mark) != (ssize_t)(written - mark))
+      changes.length = 0;
+  }
+
+  size_t skip = mark > written ? mark - written : 0;
+  if (skip < (size_t)E.journal.pending.length)
+    appendBuffer(&changes, &E.journal.pending.content[skip], E.journal.pending.length - skip);
+  E.journal.pending.length = 0;
+
+  close(E.journal.fd);
+  E.journal.fd = -1;
+  pthread_mutex_unlock(&E.journal.lock);
+
+  journalCreate();
+  if (E.journal.fd != -1) {
+    pthread_mutex_lock(&E.journal.lock);
+    appendBuffer(&E.journal.pending, changes.content, changes.length);
+    E.journal.size += changes.length;
+    pthread_mutex_unlock(&E.journal.lock);
+    journalFlush();
+  }
+
+  freeBuffer(&changes);
+}
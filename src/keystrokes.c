@@ -5,38 +5,44 @@
 #include <keystrokes.h>
 #include <lines.h>
 #include <output.h>
+#include <replacer.h>
+#include <slab.h>
 #include <terminal.h>
 #include <tools.h>
+#include <undo.h>
 
 // Handle motions 'w', 'W', 'ge' and 'gE'
 void handleOuterBoundsHorizontalMotions(bool punctuation, bool fowards) {
-  editorLine curLine = E.lines[E.cursorY];
+  int length;
+  char *content = editorLineContent(E.cursorY, &length);
   short direction = fowards ? 1 : -1;
 
-  int x = E.cursorX + (curLine.length ? direction : 0);
+  int x = E.cursorX + (length ? direction : 0);
   int y = E.cursorY;
 
   int xLimit;
   int yLimit;
 
   if (fowards) {
-    xLimit = curLine.length;
+    xLimit = length;
     yLimit = E.numlines;
   }
   else {
     xLimit = yLimit = -1;
   }
 
-  char cur = curLine.content[E.cursorX];
+  // Lines read where they lie have no terminator past their end
+  char cur = E.cursorX < length ? content[E.cursorX] : '\0';
   bool isFirstCharSpecial = isSpecial(cur);
   bool found = false;
 
   for (; y != yLimit; y += direction) {
     // When another line is reached
     if (y != E.cursorY) {
+      content = editorLineContent(y, &length);
 
       // Empty line
-      if (E.lines[y].length == 0) {
+      if (length == 0) {
         E.cursorY = y;
         E.cursorX = E.highestLastX = 0;
         return;
@@ -47,16 +53,16 @@ void handleOuterBoundsHorizontalMotions(bool punctuation, bool fowards) {
 
       if (fowards) {
         x = 0;
-        xLimit = E.lines[y].length;
+        xLimit = length;
       }
       else {
-        x = E.lines[y].length - 1;
+        x = length - 1;
         xLimit = -1;
       }
     }
 
     for (; x != xLimit; x += direction) {
-      cur = E.lines[y].content[x];
+      cur = content[x];
 
       if (!isspace(cur) && (found || (punctuation && isFirstCharSpecial ^ isSpecial(cur)))) {
         E.cursorY = y;
@@ -77,17 +83,18 @@ void handleOuterBoundsHorizontalMotions(bool punctuation, bool fowards) {
 
 // Handle motions 'e', 'E', 'b' and 'B'
 void handleInnerBoundsHorizontalMotions(bool punctuation, bool fowards) {
-  editorLine curLine = E.lines[E.cursorY];
+  int length;
+  char *content = editorLineContent(E.cursorY, &length);
   short direction = fowards ? 1 : -1; 
 
-  int x = E.cursorX + (curLine.length ? direction : 0);
+  int x = E.cursorX + (length ? direction : 0);
   int y = E.cursorY;
 
   int xLimit;
   int yLimit;
 
   if (fowards) {
-    xLimit = curLine.length;
+    xLimit = length;
     yLimit = E.numlines;
   }
   else {
@@ -96,8 +103,8 @@ void handleInnerBoundsHorizontalMotions(bool punctuation, bool fowards) {
 
   bool atTheEdgeOfLine = x == xLimit;
 
-  char curChar = curLine.content[E.cursorX];
-  char nextChar = atTheEdgeOfLine ? curChar : curLine.content[x];
+  char curChar = E.cursorX < length ? content[E.cursorX] : '\0';
+  char nextChar = atTheEdgeOfLine || x >= length ? curChar : content[x];
 
   bool isFirstCharSpecial = isSpecial(curChar);
 
@@ -110,18 +117,20 @@ void handleInnerBoundsHorizontalMotions(bool punctuation, bool fowards) {
 
   for (; y != yLimit; y += direction) {
     if (y != E.cursorY) {
+      content = editorLineContent(y, &length);
+
       if (fowards) {
         x = 0;
-        xLimit = E.lines[y].length;
+        xLimit = length;
       }
       else {
-        x = E.lines[y].length - 1;
+        x = length - 1;
         xLimit = -1;
       }
     }
 
     for (; x != xLimit; x += direction) {
-      curChar = E.lines[y].content[x];
+      curChar = content[x];
 
       if (searchNextWord) {
         if (!isspace(curChar)) {
@@ -201,7 +210,7 @@ void handleNormalMode(int c) {
     // Insert at the beginning of the line
     case 'I': {
       E.mode = INSERT;
-      E.cursorX = indentation(&E.lines[E.cursorY]);
+      E.cursorX = indentation(editorGetLine(E.cursorY));
       E.highestLastX = E.cursorX;
       break;
     }
@@ -209,7 +218,7 @@ void handleNormalMode(int c) {
     // Insert after the cursor
     case 'a':
       E.mode = INSERT;
-      if (E.lines[E.cursorY].length != 0) {
+      if (editorGetLine(E.cursorY)->length != 0) {
         E.cursorX++;
       }
       E.highestLastX = E.cursorX;
@@ -218,14 +227,14 @@ void handleNormalMode(int c) {
     // Insert at the end of the line
     case 'A':
       E.mode = INSERT;
-      E.cursorX = E.lines[E.cursorY].length;
+      E.cursorX = editorGetLine(E.cursorY)->length;
       E.highestLastX = E.cursorX;
       break;
 
     case 'o': // Append a new line bellow the current line
     case 'O': // Append a new line above the current line
     {
-      int tabs = indentation(&E.lines[E.cursorY]);
+      int tabs = indentation(editorGetLine(E.cursorY));
       char line[tabs];
       memset(line, '\t', tabs);
       editorInsertLine(c == 'o' ? ++E.cursorY : E.cursorY, line, tabs);
@@ -238,11 +247,11 @@ void handleNormalMode(int c) {
     case 'x': // delete character
     case 's': // delete character and substitute text
       if (c == 's') E.mode = INSERT;
-      if (E.lines[E.cursorY].length == 0) {
+      if (editorGetLine(E.cursorY)->length == 0) {
         if (c == 'x') editorDeleteLine(E.cursorY);
         break;
       }
-      editorLineDeleteChar(&E.lines[E.cursorY], E.cursorX);
+      editorLineDeleteChar(editorGetLine(E.cursorY), E.cursorX);
       break;
 
     // Change (replace) to the end of the line
@@ -328,6 +337,11 @@ void handleNormalMode(int c) {
         case 'E': // Jump backwards to the end of a word (words can contain punctuation) 
           handleOuterBoundsHorizontalMotions(islower(c), false);
           break;
+
+        // Show how much memory the lines take
+        case CTRL_KEY('g'):
+          slabShowStats();
+          break;
       }
       break;
     }
@@ -367,8 +381,29 @@ void handleNormalMode(int c) {
       handleInnerBoundsHorizontalMotions(islower(c), false);
       break;
 
+    // Undo the last change
+    case 'u':
+      editorUndo();
+      break;
+
+    // Redo the last change undone
+    case CTRL_KEY('r'):
+      editorRedo();
+      break;
+
+    // Search for a regular expression
+    case '/':
+      editorFindRegex();
+      break;
+
+    // Substitute matches of a pattern over a range of lines
+    case ':':
+      editorReplace();
+      break;
+
     // Go to the last line of the document
     case 'G':
+      editorLoadIndexedLines();
       moveCursorToLine(E.numlines);
       break;
 
@@ -381,7 +416,7 @@ void handleNormalMode(int c) {
     // Jump to next paragraph
     case '}':
       for (int i = E.cursorY + 1; i < E.numlines; i++) {
-        if (E.lines[i].length != 0) continue;
+        if (editorLineLength(i) != 0) continue;
         E.cursorY = i;
         fixCursorXPosition();
         return;
@@ -393,7 +428,7 @@ void handleNormalMode(int c) {
     // Jump to previus paragraph
     case '{':
       for (int i = E.cursorY - 1; i >= 0; i--) {
-        if (E.lines[i].length != 0) continue;
+        if (editorLineLength(i) != 0) continue;
         E.cursorY = i;
         fixCursorXPosition();
         return;
@@ -428,7 +463,7 @@ void handleNormalMode(int c) {
 
     case END_KEY:
     case '$':
-      E.cursorX = max(0, E.lines[E.cursorY].length - 1);
+      E.cursorX = max(0, editorGetLine(E.cursorY)->length - 1);
       break;
   }
 }
@@ -449,7 +484,7 @@ void handleInsertMode(int c) {
       break;
 
     case END_KEY:
-      E.cursorX = E.lines[E.cursorY].length;
+      E.cursorX = editorGetLine(E.cursorY)->length;
       break;
 
     case BACKSPACE:
@@ -1,6 +1,170 @@
+#include <buffer.h>
+#include <gap.h>
 #include <highlight.h>
 #include <lines.h>
 #include <output.h>
+#include <pieces.h>
+#include <slab.h>
+#include <tools.h>
+#include <undo.h>
+
+editorLine *materializeLine(int at) {
+  int offset;
+  linePiece *piece = piecesFind(at, &offset);
+
+  int length;
+  char *content = originalLineContent(piece->start + offset, &length);
+  int tabs = originalLineTabs(piece->start + offset);
+
+  int slot = addedAlloc();
+  editorLine *line = addedLine(slot);
+  line->index = at;
+  line->length = length;
+  line->content = slabAlloc(length + 1);
+  memcpy(line->content, content, length);
+  line->content[length] = '\0';
+  line->highlight = NULL;
+  line->renderContent = NULL;
+  line->renderLength = 0;
+  line->renderStart = 0;
+  line->tabStops = NULL;
+  line->numtabs = 0;
+  line->hasOwnRender = false;
+  line->startsInComment = false;
+  line->isOpenComment = false;
+  line->isHighlighted = false;
+
+  piecesRemove(at, 1, false);
+  piecesInsert(at, false, slot, 1);
+
+  // Tab counts from the index are exact unless they hit the limit
+  if (tabs == MAX_LINE_TABS)
+    tabs = editorCountTabs(line);
+
+  editorRenderLine(line, tabs);
+  return line;
+}
+
+editorLine *editorGetLine(int at) {
+  if (at < 0 || at >= E.numlines)
+    return NULL;
+
+  if (E.gap.line && E.gap.row == at)
+    gapClose();
+
+  int offset;
+  linePiece *piece = piecesFind(at, &offset);
+
+  if (!piece->isOriginal) {
+    editorLine *line = addedLine(piece->start + offset);
+    line->index = at;
+    return line;
+  }
+
+  return materializeLine(at);
+}
+
+editorLine *editorPeekLine(int at) {
+  if (at < 0 || at >= E.numlines)
+    return NULL;
+
+  if (E.gap.line && E.gap.row == at)
+    return editorViewLine(at);
+
+  int offset;
+  linePiece *piece = piecesFind(at, &offset);
+
+  if (piece->isOriginal)
+    return NULL;
+
+  editorLine *line = addedLine(piece->start + offset);
+  line->index = at;
+  return line;
+}
+
+// Returns line 'at' to be drawn or highlighted, leaving the line being
+// typed into as it is and rendering it around its gap instead
+editorLine *editorViewLine(int at) {
+  if (E.gap.line && E.gap.row == at) {
+    gapRender();
+    return E.gap.line;
+  }
+  return editorGetLine(at);
+}
+
+// Tells how long line 'at' is without loading it
+int editorLineLength(int at) {
+  if (E.gap.line && E.gap.row == at)
+    return E.gap.line->length;
+
+  int offset, length;
+  linePiece *piece = piecesFind(at, &offset);
+
+  if (piece->isOriginal)
+    originalLineContent(piece->start + offset, &length);
+  else
+    length = addedLine(piece->start + offset)->length;
+  return length;
+}
+
+// Returns the content of line 'at' to be read without loading it. The line
+// being typed into has its gap moved past its end to be read in one piece
+char *editorLineContent(int at, int *length) {
+  if (E.gap.line && E.gap.row == at) {
+    gapMove(E.gap.line->length);
+    *length = E.gap.line->length;
+    return E.gap.line->content;
+  }
+
+  int offset;
+  linePiece *piece = piecesFind(at, &offset);
+
+  if (piece->isOriginal)
+    return originalLineContent(piece->start + offset, length);
+
+  editorLine *line = addedLine(piece->start + offset);
+  *length = line->length;
+  return line->content;
+}
+
+void editorLoadLines(char *content, size_t length, bool isMapped) {
+  originalLoad(content, length, isMapped);
+  highlightInvalidate(0);
+
+  if (E.original.index.numlines == 0) {
+    E.undo.isSuspended = true;
+    editorInsertLine(0, EMPTY_STRING, 0);
+    E.undo.isSuspended = false;
+    return;
+  }
+
+  piecesInsert(0, true, 0, E.original.index.numlines);
+  E.numlines = E.original.index.numlines;
+
+  adjustSidebarWidth();
+}
+
+// The rest of the file goes right after the last indexed line, which the
+// last line of the buffer always is while it is being indexed
+void editorLoadIndexedLines(void) {
+  int first = E.original.index.numlines;
+  int count = originalIndexFinish();
+
+  if (count == 0) return;
+
+  piecesInsert(E.numlines, true, first, count);
+  E.numlines += count;
+
+  adjustSidebarWidth();
+}
+
+// Lines are only added past the end once the rest of the file is in, or
+// the rest would be spliced in after them. Lines shown on the screen are
+// loaded as added ones, so where the file ends cannot be told by pieces
+void editorLoadBeforeEnd(int at) {
+  if (at == E.numlines && E.original.indexer.isRunning)
+    editorLoadIndexedLines();
+}
 
 int indentation(editorLine *line) {
   int tabs = 0;
@@ -22,107 +186,251 @@ int indentation(editorLine *line) {
   return tabs;
 }
 
-int editorLineCxToRx(editorLine *line, int cursorX) {
-  int rx = 0;
-  for (int i = 0; i < cursorX; i++) {
-    if (line->content[i] == TAB)
-      rx += TAB_SIZE - (rx % TAB_SIZE);
+// Screen column right after the tab at tab stop 'stop'
+int tabStopEnd(tabStop *stop) {
+  return stop->rx + TAB_SIZE - stop->rx % TAB_SIZE;
+}
+
+// Counts the tab stops whose column, in content or on screen, is at most
+// 'column'
+int tabStopsUpTo(editorLine *line, int column, bool onScreen) {
+  int low = 0, high = line->numtabs;
+
+  while (low < high) {
+    int mid = (low + high) / 2;
+    int at = onScreen ? line->tabStops[mid].rx : line->tabStops[mid].cx;
+
+    if (at <= column)
+      low = mid + 1;
     else
-      rx++;
+      high = mid;
   }
-  return rx;
+  return low;
 }
 
-int editorLineRxToCx(editorLine *line, int rCursorX) {
-  int rx = 0;
-  int cx;
+int editorLineCxToRx(editorLine *line, int cursorX) {
+  int before = tabStopsUpTo(line, cursorX - 1, false);
+
+  if (before == 0)
+    return cursorX;
+
+  tabStop *stop = &line->tabStops[before - 1];
+  return tabStopEnd(stop) + cursorX - stop->cx - 1;
+}
 
-  for (cx = 0; cx < line->length; cx++) {
-    if (line->content[cx] == TAB)
-      rx += TAB_SIZE - (rx % TAB_SIZE);
-    else 
-      rx++;
+// Screen column of column 'cx' of line 'at', found for the line being typed
+// into without rendering all of it
+int editorRowCxToRx(int at, int cx) {
+  if (E.gap.line && E.gap.row == at)
+    return gapCxToRx(cx);
+  return editorLineCxToRx(editorViewLine(at), cx);
+}
+
+int editorLineRxToCx(editorLine *line, int rCursorX) {
+  int before = tabStopsUpTo(line, rCursorX, true);
+  int cx = rCursorX;
 
-    if (rx > rCursorX)
-      return cx;
+  if (before > 0) {
+    tabStop *stop = &line->tabStops[before - 1];
+    int end = tabStopEnd(stop);
+    cx = rCursorX < end ? stop->cx : stop->cx + 1 + rCursorX - end;
   }
 
-  return cx;
+  return min(cx, line->length);
 }
 
-void editorUpdateLine(editorLine *line) {
+int editorCountTabs(editorLine *line) {
   int tabs = 0;
   for (int i = 0; i < line->length; i++) {
     if (line->content[i] == TAB)
       tabs++;
   }
-  
-  free(line->renderContent);
-  line->renderContent = malloc(line->length + (TAB_SIZE - 1) * tabs + 1);
+  return tabs;
+}
+
+void editorUpdateLine(editorLine *line) {
+  editorRenderLine(line, editorCountTabs(line));
+  editorUpdateHighlight(line);
+}
+
+void editorDropRender(editorLine *line) {
+  if (line->hasOwnRender) {
+    slabFree(line->renderContent);
+    slabFree(line->tabStops);
+  }
+
+  line->renderContent = NULL;
+  line->tabStops = NULL;
+  line->numtabs = 0;
+  line->renderStart = 0;
+  line->hasOwnRender = false;
+}
+
+void editorRenderLine(editorLine *line, int tabs) {
+  editorDropRender(line);
+
+  if (tabs == 0) {
+    line->renderContent = line->content;
+    line->renderLength = line->length;
+    return;
+  }
+
+  editorRenderParts(line, line->content, line->length, NULL, tabs);
+}
+
+// Renders the line into memory of its own from its first 'split' bytes in
+// 'head' and the rest in 'tail'
+void editorRenderParts(editorLine *line, char *head, int split, char *tail, int tabs) {
+  line->renderContent = slabAlloc(line->length + (TAB_SIZE - 1) * tabs + 1);
+  line->tabStops = tabs ? slabAlloc(sizeof(tabStop) * tabs) : NULL;
+  line->numtabs = tabs;
+  line->hasOwnRender = true;
 
   int index = 0;
+  int stop = 0;
   for (int i = 0; i < line->length; i++) {
-    if (line->content[i] == TAB) {
+    char c = i < split ? head[i] : tail[i - split];
+
+    if (c == TAB) {
+      line->tabStops[stop++] = (tabStop){i, index};
+
       line->renderContent[index++] = SPACE;
       while (index % TAB_SIZE != 0)
         line->renderContent[index++] = SPACE;
     }
     else {
-      line->renderContent[index++] = line->content[i];
+      line->renderContent[index++] = c;
     }
   }
 
   line->renderContent[index] = '\0';
   line->renderLength = index;
-
-  editorUpdateHighlight(line);
+  line->numtabs = stop;
 }
 
 void editorInsertLine(int at, char *line, size_t length) {
   if (at < 0 || at > E.numlines)
     return;
 
-  E.lines = realloc(E.lines, sizeof(editorLine) * (E.numlines + 1));
-  memmove(&E.lines[at + 1], &E.lines[at], sizeof(editorLine) * (E.numlines - at));
+  editorLoadBeforeEnd(at);
+  gapClose();
+
+  int slot = addedAlloc();
+  editorLine *new = addedLine(slot);
+
+  new->index = at;
+  new->length = length;
+  new->content = slabAlloc(length + 1);
+  memcpy(new->content, line, length);
+  new->content[length] = '\0';
+
+  new->highlight = NULL;
+  new->renderContent = NULL;
+  new->renderLength = 0;
+  new->renderStart = 0;
+  new->tabStops = NULL;
+  new->numtabs = 0;
+  new->hasOwnRender = false;
+  new->startsInComment = false;
+  new->isOpenComment = false;
+  new->isHighlighted = false;
+
+  piecesInsert(at, false, slot, 1);
+  E.numlines++;
+  editorUpdateLine(new);
+  undoPush(UNDO_INSERT_LINES, at, 0, 1, line, length);
 
-  for (int i = at + 1; i <= E.numlines; i++)
-    E.lines[i].index++;
+  adjustSidebarWidth();
+}
 
-  E.lines[at].index = at;
+// Splits text at its line feeds and inserts all of its lines at once,
+// returning how many there were
+int editorInsertLines(int at, char *text, size_t length) {
+  if (at < 0 || at > E.numlines)
+    return 0;
 
-  E.lines[at].length = length;
-  E.lines[at].content = malloc(length + 1);
-  memcpy(E.lines[at].content, line, length);
-  E.lines[at].content[length] = '\0';
+  editorLoadBeforeEnd(at);
+  gapClose();
 
-  E.lines[at].highlight = NULL;
-  E.lines[at].renderContent = NULL;
-  E.lines[at].renderLength = 0;
-  E.lines[at].isOpenComment = false;
+  int count = 1;
+  for (size_t i = 0; i < length; i++) {
+    if (text[i] == LINE_FEED)
+      count++;
+  }
 
-  editorUpdateLine(&E.lines[at]);
-  E.numlines++;
+  int first = addedAllocRun(count);
+  size_t start = 0;
+
+  for (int i = 0; i < count; i++) {
+    char *newline = memchr(&text[start], LINE_FEED, length - start);
+    size_t end = newline ? (size_t)(newline - text) : length;
+
+    editorLine *line = addedLine(first + i);
+    line->index = at + i;
+    line->length = end - start;
+    line->content = slabAlloc(line->length + 1);
+    memcpy(line->content, &text[start], line->length);
+    line->content[line->length] = '\0';
+
+    line->highlight = NULL;
+    line->renderContent = NULL;
+    line->renderLength = 0;
+    line->renderStart = 0;
+    line->tabStops = NULL;
+    line->numtabs = 0;
+    line->hasOwnRender = false;
+    line->startsInComment = false;
+    line->isOpenComment = false;
+    line->isHighlighted = false;
+    editorRenderLine(line, editorCountTabs(line));
+
+    start = end + 1;
+  }
+
+  piecesInsert(at, false, first, count);
+  E.numlines += count;
+  highlightInvalidate(at);
+  undoPush(UNDO_INSERT_LINES, at, 0, count, text, length);
+
+  adjustSidebarWidth();
+  return count;
+}
+
+// Puts lines of the original file from 'first' on back at 'at', as when
+// their deletion is undone, which leaves nothing to log
+void editorInsertOriginalLines(int at, int first, int count) {
+  if (at < 0 || at > E.numlines)
+    return;
+
+  gapClose();
+
+  piecesInsert(at, true, first, count);
+  E.numlines += count;
+  highlightInvalidate(at);
 
   adjustSidebarWidth();
 }
 
 void editorFreeLine(editorLine *line) {
-  free(line->content);
-  free(line->renderContent);
-  free(line->highlight);
+  editorDropRender(line);
+  slabFree(line->content);
+  slabFree(line->highlight);
 }
 
 void editorDeleteLine(int at) {
-  if (at < 0 || at >= E.numlines)
-    return;
+  editorDeleteLines(at, 1);
+}
 
-  editorFreeLine(&E.lines[at]);
-  memmove(&E.lines[at], &E.lines[at + 1], sizeof(editorLine) * (E.numlines - at - 1));
+void editorDeleteLines(int at, int count) {
+  if (at < 0 || count <= 0 || at + count > E.numlines)
+    return;
 
-  for (int i = at; i < E.numlines - 1; i++)
-    E.lines[i].index--;
+  undoDeleteLines(at, count);
+  gapClose();
 
-  E.numlines--;
+  piecesRemove(at, count, true);
+  E.numlines -= count;
+  highlightInvalidate(at);
 
   adjustSidebarWidth();
 }
@@ -131,74 +439,116 @@ void editorLineInsertChar(editorLine *line, int at, int c) {
   if (at < 0 || at > line->length) 
     at = line->length;
 
-  line->content = realloc(line->content, line->length + 2);
+  line->content = slabRealloc(line->content, line->length + 2);
   memmove(&line->content[at + 1], &line->content[at], line->length - at + 1);
   line->length++;
   line->content[at] = c;
+  undoPush(UNDO_INSERT_TEXT, line->index, at, 1, &line->content[at], 1);
+  editorUpdateLine(line);
+}
+
+void editorLineInsertString(editorLine *line, int at, char *s, size_t len) {
+  if (at < 0 || at > line->length)
+    at = line->length;
+
+  line->content = slabRealloc(line->content, line->length + len + 1);
+  memmove(&line->content[at + len], &line->content[at], line->length - at + 1);
+  memcpy(&line->content[at], s, len);
+  line->length += len;
+  undoPush(UNDO_INSERT_TEXT, line->index, at, 1, s, len);
   editorUpdateLine(line);
 }
 
 void editorLineAppendString(editorLine *line, char *s, size_t len) {
-  line->content = realloc(line->content, line->length + len + 1);
+  line->content = slabRealloc(line->content, line->length + len + 1);
   memcpy(&line->content[line->length], s, len);
+  undoPush(UNDO_INSERT_TEXT, line->index, line->length, 1, s, len);
   line->length += len;
   line->content[line->length] = '\0';
   editorUpdateLine(line);
 }
 
+// Puts 's' in place of the whole content of the line at once, logging only
+// the span where the two differ
+void editorLineReplaceString(editorLine *line, char *s, size_t len) {
+  int shortest = min(line->length, len);
+  int prefix = 0, suffix = 0;
+
+  while (prefix < shortest && line->content[prefix] == s[prefix])
+    prefix++;
+  while (suffix < shortest - prefix && line->content[line->length - 1 - suffix] == s[len - 1 - suffix])
+    suffix++;
+
+  int removed = line->length - prefix - suffix;
+  int added = len - prefix - suffix;
+  if (removed == 0 && added == 0) return;
+
+  if (removed) undoPush(UNDO_DELETE_TEXT, line->index, prefix, 1, &line->content[prefix], removed);
+  if (added) undoPush(UNDO_INSERT_TEXT, line->index, prefix, 1, &s[prefix], added);
+
+  if (added > removed)
+    line->content = slabRealloc(line->content, len + 1);
+
+  memmove(&line->content[prefix + added], &line->content[prefix + removed], suffix + 1);
+  memcpy(&line->content[prefix], &s[prefix], added);
+  line->length = len;
+  editorUpdateLine(line);
+}
+
+// Past the end of the line, the last character goes
 void editorLineDeleteChar(editorLine *line, int at) {
-  if (at < 0 || at > line->length)
+  editorLineDeleteString(line, at == line->length ? at - 1 : at, 1);
+}
+
+void editorLineDeleteString(editorLine *line, int at, size_t len) {
+  if (at < 0 || at >= line->length)
     return;
 
-  memmove(&line->content[at], &line->content[at + 1], line->length - at);
-  line->length--; 
+  if (len > (size_t)(line->length - at))
+    len = line->length - at;
+
+  undoPush(UNDO_DELETE_TEXT, line->index, at, 1, &line->content[at], len);
+
+  memmove(&line->content[at], &line->content[at + len], line->length - at - len + 1);
+  line->length -= len;
   editorUpdateLine(line);
 }
 
 void deleteToEndOFLine(int at) {
   if (at < 0 || at + 1 >= E.numlines) return;
 
-  editorLine *line = &E.lines[at];
-  line->length = E.cursorX;
-  line->content = realloc(line->content, line->length + 1);
-  line->content[line->length] = '\0';
-  editorUpdateLine(line);
+  editorLine *line = editorGetLine(at);
+  editorLineDeleteString(line, E.cursorX, line->length - E.cursorX);
 }
 
 void deleteLineContent(int at) {
-  editorLine *line = &E.lines[at];
-  line->content = realloc(line->content, 1);
-  *line->content = '\0';
-  line->length = 0;
-
+  editorLine *line = editorGetLine(at);
+  editorLineDeleteString(line, 0, line->length);
   E.cursorX = line->length;
-  editorUpdateLine(line);
 }
 
 void changeEntireLine(int at) {
   if (at < 0 || at + 1 >= E.numlines) return;
 
-  editorLine *line = &E.lines[at];
-  editorLine *prevLine = at ? &E.lines[at - 1] : line;
+  editorLine *line = editorGetLine(at);
+  editorLine *prevLine = at ? editorGetLine(at - 1) : line;
 
   int tabs = line->length ? indentation(line) : indentation(prevLine);
+  char indent[tabs + 1];
+  memset(indent, TAB, tabs);
 
-  free(line->content);
-  line->content = malloc(tabs + 1);
-  line->length = tabs;
-  memset(line->content, TAB, tabs);
-  line->content[tabs] = '\0';
+  editorLineDeleteString(line, 0, line->length);
+  editorLineInsertString(line, 0, indent, tabs);
 
   E.cursorX = line->length;
-  editorUpdateLine(line);
 }
 
 void joinLines(int dest, int src, bool withSpace) {
   if (src < 0 || src + 1 >= E.numlines) return;
   if (dest < 0 || dest + 1 >= E.numlines) return;
 
-  editorLine *curLine = &E.lines[src];
-  editorLine *nextLine = &E.lines[dest];
+  editorLine *curLine = editorGetLine(src);
+  editorLine *nextLine = editorGetLine(dest);
 
   int spaces = 0;
   if (withSpace) {
@@ -206,21 +556,22 @@ void joinLines(int dest, int src, bool withSpace) {
       if (!isspace(nextLine->content[spaces])) break;
       spaces++;
     }
-    nextLine->length -= spaces;
 
-    if (nextLine->length)
+    if (nextLine->length > spaces)
       editorLineInsertChar(curLine, curLine->length, SPACE);
   }
 
-  editorLineAppendString(curLine, &nextLine->content[spaces], nextLine->length);
+  editorLineAppendString(curLine, &nextLine->content[spaces], nextLine->length - spaces);
   editorDeleteLine(dest);
 }
 
 void freeMemory(void) {
   free(E.filename);
-  for (int i = 0; i < E.numlines; i++) {
-    editorFreeLine(&E.lines[i]);
-  }
-  free(E.lines);
+  free(E.checkpoints.states);
+  free(E.screen.front);
+  free(E.screen.back);
+  freeBuffer(&E.screen.output);
+  piecesFree();
+  undoClear();
 }
 
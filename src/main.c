@@ -1,21 +1,40 @@
+#include <batch.h>
 #include <fileio.h>
 #include <init.h>
 #include <input.h>
 #include <output.h>
 #include <terminal.h>
+#include <tools.h>
 
 int main(int argc, char **argv) {
-  enableRawMode();
+  char *filename = batchOptions(argc, argv);
+
+  if (!E.batch.isRunning)
+    enableRawMode();
   initEditor();
   initColors();
+  initHighlightDataBase();
+
+  long start = currentMicroseconds();
+  editorOpen(filename);
+  batchTime(&E.batch.load, start);
 
-  editorOpen(argc >= 2 ? argv[1] : NULL);
+  long lastFrame = 0;
 
   while (true) {
-    editorRefreshScreen();
+    // Keys already waiting are handled before drawing again, with a frame
+    // every FRAME_INTERVAL milliseconds so long bursts still show progress
+    if (!editorInputPending() || currentMilliseconds() - lastFrame >= FRAME_INTERVAL) {
+      start = currentMicroseconds();
+      editorRefreshScreen();
+      batchTime(&E.batch.frames, start);
+      lastFrame = currentMilliseconds();
+    }
+
+    start = currentMicroseconds();
     editorProcessKeypress();
+    batchTime(&E.batch.keys, start);
   }
 
   return 0;
 }
-
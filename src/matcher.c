@@ -0,0 +1,190 @@
+#include <matcher.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define MATCHER_X86
+  #include <immintrin.h>
+#endif
+
+// Looks for a query in raw text, in either direction. Vectors of positions
+// are filtered on the first and the last byte of the query at once, so the
+// rest of it is only compared where both agree; without vectors, the scan
+// skips ahead Horspool style on the byte under the end of the window
+
+void matcherCompile(matchPattern *pattern, char *query, size_t length) {
+  pattern->query = query;
+  pattern->length = length;
+
+  for (int c = 0; c < 256; c++)
+    pattern->forward[c] = pattern->backward[c] = length;
+
+  for (size_t i = 0; i + 1 < length; i++)
+    pattern->forward[(unsigned char)query[i]] = length - 1 - i;
+
+  for (size_t i = length - 1; i > 0; i--)
+    pattern->backward[(unsigned char)query[i]] = i;
+}
+
+// Checks the candidates of a vector of positions from 'base', lowest first
+char *matcherFirstCandidate(matchPattern *pattern, char *text, size_t base, unsigned int candidates) {
+  while (candidates) {
+    int bit = __builtin_ctz(candidates);
+    if (!memcmp(&text[base + bit], pattern->query, pattern->length))
+      return &text[base + bit];
+    candidates &= candidates - 1;
+  }
+  return NULL;
+}
+
+// Checks the candidates of a vector of positions from 'base', highest first
+char *matcherLastCandidate(matchPattern *pattern, char *text, size_t base, unsigned int candidates) {
+  while (candidates) {
+    int bit = 31 - __builtin_clz(candidates);
+    if (!memcmp(&text[base + bit], pattern->query, pattern->length))
+      return &text[base + bit];
+    candidates &= ~(1u << bit);
+  }
+  return NULL;
+}
+
+// Scans the positions from 'pos' on, going up
+char *matcherNextScalar(matchPattern *pattern, char *text, size_t pos, size_t length) {
+  size_t n = pattern->length;
+  unsigned char last = pattern->query[n - 1];
+
+  while (pos + n <= length) {
+    unsigned char c = text[pos + n - 1];
+    if (c == last && !memcmp(&text[pos], pattern->query, n - 1))
+      return &text[pos];
+    pos += pattern->forward[c];
+  }
+  return NULL;
+}
+
+// Scans the positions up to 'last' going down
+char *matcherPreviousScalar(matchPattern *pattern, char *text, size_t last) {
+  size_t n = pattern->length;
+  unsigned char first = pattern->query[0];
+  size_t pos = last;
+
+  while (true) {
+    unsigned char c = text[pos];
+    if (c == first && !memcmp(&text[pos + 1], pattern->query + 1, n - 1))
+      return &text[pos];
+
+    size_t shift = pattern->backward[c];
+    if (shift > pos) return NULL;
+    pos -= shift;
+  }
+}
+
+#ifdef MATCHER_X86
+__attribute__((target("sse2")))
+char *matcherNextSSE2(matchPattern *pattern, char *text, size_t *pos, size_t length) {
+  size_t n = pattern->length;
+  const __m128i first = _mm_set1_epi8(pattern->query[0]);
+  const __m128i last = _mm_set1_epi8(pattern->query[n - 1]);
+
+  for (; *pos + n - 1 + 16 <= length; *pos += 16) {
+    __m128i starts = _mm_loadu_si128((const __m128i *)(text + *pos));
+    __m128i ends = _mm_loadu_si128((const __m128i *)(text + *pos + n - 1));
+    unsigned int candidates = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(starts, first), _mm_cmpeq_epi8(ends, last)));
+
+    char *match = matcherFirstCandidate(pattern, text, *pos, candidates);
+    if (match) return match;
+  }
+  return NULL;
+}
+
+__attribute__((target("avx2")))
+char *matcherNextAVX2(matchPattern *pattern, char *text, size_t *pos, size_t length) {
+  size_t n = pattern->length;
+  const __m256i first = _mm256_set1_epi8(pattern->query[0]);
+  const __m256i last = _mm256_set1_epi8(pattern->query[n - 1]);
+
+  for (; *pos + n - 1 + 32 <= length; *pos += 32) {
+    __m256i starts = _mm256_loadu_si256((const __m256i *)(text + *pos));
+    __m256i ends = _mm256_loadu_si256((const __m256i *)(text + *pos + n - 1));
+    unsigned int candidates = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(starts, first), _mm256_cmpeq_epi8(ends, last)));
+
+    char *match = matcherFirstCandidate(pattern, text, *pos, candidates);
+    if (match) return match;
+  }
+  return NULL;
+}
+
+// The backward scans check the vector of positions that ends at *end, and
+// leave *end past the positions still to be checked
+__attribute__((target("sse2")))
+char *matcherPreviousSSE2(matchPattern *pattern, char *text, size_t *end) {
+  size_t n = pattern->length;
+  const __m128i first = _mm_set1_epi8(pattern->query[0]);
+  const __m128i last = _mm_set1_epi8(pattern->query[n - 1]);
+
+  for (; *end >= 16; *end -= 16) {
+    size_t base = *end - 16;
+    __m128i starts = _mm_loadu_si128((const __m128i *)(text + base));
+    __m128i ends = _mm_loadu_si128((const __m128i *)(text + base + n - 1));
+    unsigned int candidates = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(starts, first), _mm_cmpeq_epi8(ends, last)));
+
+    char *match = matcherLastCandidate(pattern, text, base, candidates);
+    if (match) return match;
+  }
+  return NULL;
+}
+
+__attribute__((target("avx2")))
+char *matcherPreviousAVX2(matchPattern *pattern, char *text, size_t *end) {
+  size_t n = pattern->length;
+  const __m256i first = _mm256_set1_epi8(pattern->query[0]);
+  const __m256i last = _mm256_set1_epi8(pattern->query[n - 1]);
+
+  for (; *end >= 32; *end -= 32) {
+    size_t base = *end - 32;
+    __m256i starts = _mm256_loadu_si256((const __m256i *)(text + base));
+    __m256i ends = _mm256_loadu_si256((const __m256i *)(text + base + n - 1));
+    unsigned int candidates = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(starts, first), _mm256_cmpeq_epi8(ends, last)));
+
+    char *match = matcherLastCandidate(pattern, text, base, candidates);
+    if (match) return match;
+  }
+  return NULL;
+}
+#endif
+
+// Returns the first match in text[0, length), or NULL
+char *matcherNext(matchPattern *pattern, char *text, size_t length) {
+  if (pattern->length == 0 || pattern->length > length)
+    return NULL;
+
+  size_t pos = 0;
+  char *match = NULL;
+
+#ifdef MATCHER_X86
+  if (__builtin_cpu_supports("avx2"))
+    match = matcherNextAVX2(pattern, text, &pos, length);
+  else if (__builtin_cpu_supports("sse2"))
+    match = matcherNextSSE2(pattern, text, &pos, length);
+#endif
+
+  return match ? match : matcherNextScalar(pattern, text, pos, length);
+}
+
+// Returns the last match in text[0, length), or NULL
+char *matcherPrevious(matchPattern *pattern, char *text, size_t length) {
+  if (pattern->length == 0 || pattern->length > length)
+    return NULL;
+
+  // One past the last position a match can start at
+  size_t end = length - pattern->length + 1;
+  char *match = NULL;
+
+#ifdef MATCHER_X86
+  if (__builtin_cpu_supports("avx2"))
+    match = matcherPreviousAVX2(pattern, text, &end);
+  else if (__builtin_cpu_supports("sse2"))
+    match = matcherPreviousSSE2(pattern, text, &end);
+#endif
+
+  if (match) return match;
+  return end ? matcherPreviousScalar(pattern, text, end - 1) : NULL;
+}
@@ -1,34 +1,45 @@
 #include <buffer.h>
+#include <finder.h>
 #include <highlight.h>
+#include <highlighter.h>
+#include <input.h>
 #include <lines.h>
 #include <output.h>
+#include <saver.h>
+#include <screen.h>
 #include <stdio.h>
 #include <string.h>
 #include <tools.h>
 
 void editorRefreshScreen(void) {
-  E.rCursorX = E.cursorY < E.numlines ? editorLineCxToRx(&E.lines[E.cursorY], E.cursorX) : 0;
+  E.rCursorX = E.cursorY < E.numlines ? editorRowCxToRx(E.cursorY, E.cursorX) : 0;
 
   editorScrollX();
   editorScrollY();
+  editorHighlightViewport();
 
-  buffer buff = BUFFER_INIT;
+  screenBegin();
 
-  appendBuffer(&buff, "\x1b[?25l", 6); // Make cursor invisible
-  appendBuffer(&buff, "\x1b[H", 3); // Moves cursor to home position (0, 0)
-
-  editorDrawLines(&buff);
+  editorDrawLines();
   if (E.isPromptOpen)
-    editorDrawPromptBar(&buff);
+    editorDrawPromptBar();
   else
-    editorDrawStatusBar(&buff);
+    editorDrawStatusBar();
+
+  int cursorRow = E.cursorY - E.rowOffset;
+  int cursorCol = E.rCursorX - E.colOffset + E.sidebarWidth;
 
-  editorSetCursorPosition(&buff);
+  screenFlush(cursorRow, cursorCol);
+}
 
-  appendBuffer(&buff, "\x1b[?25h", 6); // Make cursor visible
+// Redraws the screen for something that happened in the background, with
+// the bar and the cursor left as the user last saw them
+void editorRepaintScreen(void) {
+  E.isPromptOpen = E.isMessageShown;
+  editorRefreshScreen();
 
-  write(STDOUT_FILENO, buff.content, buff.length);
-  freeBuffer(&buff);
+  if (E.isPrompting)
+    refreshPromptCursor();
 }
 
 void editorScrollX(void) {
@@ -51,31 +62,33 @@ void editorScrollY(void) {
   E.rowOffset = clamp(minOffset, E.rowOffset, maxOffset);
 }
 
-void editorDrawLines(buffer *buff) {
+void editorDrawLines(void) {
   for (int i = 0; i < E.screenRows; i++) {
     int filerow = i + E.rowOffset;
     color_t backgroundColor = filerow == E.cursorY ? theme.activeLine : theme.background;
 
-    setDefaultColors(buff);
+    setDefaultColors();
     
     if (filerow < E.numlines) {
-      printLineNumber(filerow, buff);
-      editorHighlightOutput(buff, backgroundColor);
-      printTextLine(filerow, backgroundColor, buff);
+      printLineNumber(filerow);
+      screenSetColor(backgroundColor);
+      printTextLine(filerow, backgroundColor);
     }
 
     if (E.splashScreen && i == E.screenRows / 3) {
-      printSplashScreen(buff);
+      printSplashScreen();
     }
 
-    appendBuffer(buff, "\x1b[K", 3); // Erase from cursor to end of line
-    appendBuffer(buff, "\r\n", 2);   // Carriage Return + Line Feed
+    screenEraseLine();
+    screenNewline();
   }
 
-  setDefaultColors(buff);
+  setDefaultColors();
 }
 
-void editorDrawStatusBar(buffer *buff) {
+void editorDrawStatusBar(void) {
+  E.isMessageShown = false;
+
   color_t modeColor = theme.mode.normal;
   char mode[80];
   int modeLen = sprintf(mode, " NORMAL ");
@@ -85,21 +98,37 @@ void editorDrawStatusBar(buffer *buff) {
     modeLen = sprintf(mode, " INSERT ");
   }
 
-  appendBuffer(buff, "\x1b[1m", 4);
-  editorHighlightOutput(buff, modeColor);
-  editorHighlightOutput(buff, theme.mode.text);
-  appendBuffer(buff, mode, modeLen);
-  appendBuffer(buff, "\x1b[22m", 5);
+  screenSetBold(true);
+  screenSetColor(modeColor);
+  screenSetColor(theme.mode.text);
+  screenWrite(mode, modeLen);
+  screenSetBold(false);
 
   const char *filename = E.filename ? E.filename : "[No name]";
   const char *modified = E.dirty ? " *" : EMPTY_STRING;
 
-  char bufferInfo[80];
-  int bufferLen = snprintf(bufferInfo, sizeof(bufferInfo), " %.20s%s ", filename, modified);
+  char saving[16] = EMPTY_STRING;
+  int percent;
+  if (saverProgress(&percent))
+    snprintf(saving, sizeof(saving), " saving %d%%", percent);
+
+  char matches[40] = EMPTY_STRING;
+  int current, total;
+  if (findPosition(&current, &total)) {
+    if (total < 0)
+      snprintf(matches, sizeof(matches), " searching");
+    else if (current >= 0)
+      snprintf(matches, sizeof(matches), " match %d of %d", current + 1, total);
+    else
+      snprintf(matches, sizeof(matches), " %d %s", total, total == 1 ? "match" : "matches");
+  }
+
+  char bufferInfo[120];
+  int bufferLen = snprintf(bufferInfo, sizeof(bufferInfo), " %.20s%s%s%s ", filename, modified, saving, matches);
   bufferLen = min(bufferLen, E.screenCols);
-  editorHighlightOutput(buff, theme.buffer.active.background);
-  editorHighlightOutput(buff, theme.buffer.active.text);
-  appendBuffer(buff, bufferInfo, bufferLen);
+  screenSetColor(theme.buffer.active.background);
+  screenSetColor(theme.buffer.active.text);
+  screenWrite(bufferInfo, bufferLen);
 
   char percentage[5];
   if (E.numlines == 0 || E.cursorY == 0) {
@@ -139,46 +168,34 @@ void editorDrawStatusBar(buffer *buff) {
   char position[128];
   int posLen = sprintf(position, " %s  %s ", cursorPosition, percentage);
 
-  editorHighlightOutput(buff, theme.statusBar);
+  screenSetColor(theme.statusBar);
   for (int n = bufferLen + modeLen; n < E.screenCols; n++) {
     if (E.screenCols - n == posLen) {
-      appendBuffer(buff, "\x1b[1m", 4);
-      editorHighlightOutput(buff, theme.mode.text);
-      editorHighlightOutput(buff, modeColor);
-      appendBuffer(buff, position, posLen);
-      appendBuffer(buff, "\x1b[22m", 5);
+      screenSetBold(true);
+      screenSetColor(theme.mode.text);
+      screenSetColor(modeColor);
+      screenWrite(position, posLen);
+      screenSetBold(false);
       break;
     }
-    appendBuffer(buff, " ", 1);
+    screenWrite(" ", 1);
   }
-
-  appendBuffer(buff, "\x1b[0m", 4); // Reset style and colors
 }
 
-void editorDrawPromptBar(buffer *buff) {
-  editorHighlightOutput(buff, theme.background);
-  editorHighlightOutput(buff, theme.text.standard);
-  appendBuffer(buff, "\x1b[K", 3); // Erase from cursor to end of line
+void editorDrawPromptBar(void) {
+  screenSetColor(theme.background);
+  screenSetColor(theme.text.standard);
+  screenEraseLine();
 
   int len = strlen(E.statusmsg);
   len = min(len, E.screenCols);
 
+  E.isMessageShown = E.isPromptOpen;
+
   if (E.isPromptOpen) {
-    appendBuffer(buff, E.statusmsg, len);
+    screenWrite(E.statusmsg, len);
     E.isPromptOpen = false;
   }
-
-  appendBuffer(buff, "\x1b[0m", 4); // Reset style and colors
-}
-
-void editorSetCursorPosition(buffer *buff) {
-  char temp[32];
-  
-  int cx = (E.rCursorX - E.colOffset + E.sidebarWidth) + 1;
-  int cy = (E.cursorY - E.rowOffset) + 1;
-
-  snprintf(temp, sizeof(temp), "\x1b[%d;%dH", cy, cx);
-  appendBuffer(buff, temp, strlen(temp));
 }
 
 void editorSetStatusMessage(const char *format, ...) {
@@ -189,23 +206,40 @@ void editorSetStatusMessage(const char *format, ...) {
   E.isPromptOpen = true;
 }
 
+// Returns the cached escape sequence of a color, encoding it on first use
+colorSequence *colorSequenceFor(color_t color) {
+  uint32_t key = 1 + ((uint32_t)color.isBackground << 24 | color.r << 16 | color.g << 8 | color.b);
+  unsigned int home = (key * 2654435761u) % COLOR_CACHE_SIZE;
+
+  colorSequence *entry = &colorCache[home];
+  for (int i = 0; i < COLOR_CACHE_SIZE; i++) {
+    entry = &colorCache[(home + i) % COLOR_CACHE_SIZE];
+    if (entry->key == key) return entry;
+    if (entry->key == 0) break;
+  }
+
+  // A full cache just gives up the last slot it looked at
+  entry->key = key;
+  entry->length = snprintf(
+                    entry->sequence,
+                    sizeof(entry->sequence),
+                    color.isBackground ? "\x1b[48;2;%d;%d;%dm" : "\x1b[38;2;%d;%d;%dm",
+                    color.r, color.g, color.b
+                  );
+  return entry;
+}
+
 void editorHighlightOutput(buffer *buff, color_t color) {
-  char ansi[24];
-  int len = snprintf(
-              ansi,
-              sizeof(ansi),
-              color.isBackground ? "\x1b[48;2;%d;%d;%dm" : "\x1b[38;2;%d;%d;%dm",
-              color.r, color.g, color.b
-            );
-  appendBuffer(buff, ansi, len);
+  colorSequence *cached = colorSequenceFor(color);
+  appendBuffer(buff, cached->sequence, cached->length);
 }
 
-void setDefaultColors(buffer *buff) {
-  editorHighlightOutput(buff, theme.text.standard);
-  editorHighlightOutput(buff, theme.background);
+void setDefaultColors(void) {
+  screenSetColor(theme.text.standard);
+  screenSetColor(theme.background);
 }
 
-void printLineNumber(int row, buffer *buff) {
+void printLineNumber(int row) {
   char sidebarLine[E.sidebarWidth];
   memset(sidebarLine, SPACE, E.sidebarWidth);
   sidebarLine[E.sidebarWidth] = '\0';
@@ -214,46 +248,60 @@ void printLineNumber(int row, buffer *buff) {
   int n;
 
   if (row == E.cursorY) {
-    editorHighlightOutput(buff, theme.sidebar.activeNumber);
+    screenSetColor(theme.sidebar.activeNumber);
     n = snprintf(num, E.sidebarWidth, "%d", row + 1);
     memcpy(sidebarLine + 1, num, n);
   }
   else {
-    editorHighlightOutput(buff, theme.sidebar.number);
+    screenSetColor(theme.sidebar.number);
     n = snprintf(num, E.sidebarWidth, "%d", abs(row - E.cursorY));
     memcpy(sidebarLine + E.sidebarWidth - n - 2, num, n);
   }
 
-  appendBuffer(buff, sidebarLine, E.sidebarWidth);
-  editorHighlightOutput(buff, theme.text.standard);
+  screenWrite(sidebarLine, E.sidebarWidth);
+  screenSetColor(theme.text.standard);
 }
 
-void printTextLine(int row, color_t background, buffer *buff) {
+void printTextLine(int row, color_t background) {
+  unsigned char prevToken = TOKEN_TEXT;
   color_t prevColor = theme.text.standard;
 
-  char *content = &E.lines[row].renderContent[E.colOffset];
-  color_t *highlight = &E.lines[row].highlight[E.colOffset];
-
-  int length = clamp(0, E.lines[row].renderLength - E.colOffset, E.screenCols - E.sidebarWidth);
-
-  for (int j = 0; j < length; j++) {
-    color_t curColor = highlight[j];
-
-    if (!colorcmp(curColor, prevColor)) {
-      if (curColor.isBackground)
-        editorHighlightOutput(buff, curColor.isDark ? theme.text.light : theme.text.dark);
-      else if (prevColor.isBackground)
-        editorHighlightOutput(buff, background);
-
-      editorHighlightOutput(buff, curColor);
-      prevColor = curColor;
+  editorLine *line = editorViewLine(row);
+  int skip = E.colOffset - line->renderStart;
+  char *content = &line->renderContent[skip];
+  unsigned char *highlight = &line->highlight[skip];
+
+  int length = clamp(0, line->renderLength - skip, E.screenCols - E.sidebarWidth);
+
+  // Each run of one token is written at once
+  int j = 0;
+  while (j < length) {
+    int run = j + 1;
+    while (run < length && highlight[run] == highlight[j])
+      run++;
+
+    // Tokens can share a color, which then needs no escape sequence
+    if (highlight[j] != prevToken) {
+      color_t curColor = *palette[highlight[j]];
+      prevToken = highlight[j];
+
+      if (!colorcmp(curColor, prevColor)) {
+        if (curColor.isBackground)
+          screenSetColor(curColor.isDark ? theme.text.light : theme.text.dark);
+        else if (prevColor.isBackground)
+          screenSetColor(background);
+
+        screenSetColor(curColor);
+        prevColor = curColor;
+      }
     }
-    appendBuffer(buff, &content[j], 1);
+    screenWrite(&content[j], run - j);
+    j = run;
   }
-  editorHighlightOutput(buff, background);
+  screenSetColor(background);
 }
 
-void printSplashScreen(buffer *buff) {
+void printSplashScreen(void) {
   char welcome[80];
   int length = snprintf(welcome, sizeof(welcome), "Kilo editor -- version %s", KILO_VERSION);
 
@@ -262,9 +310,9 @@ void printSplashScreen(buffer *buff) {
   int padding = (E.screenCols - length) / 2;
 
   while (padding--) {
-    appendBuffer(buff, " ", 1);
+    screenWrite(" ", 1);
   }
-  appendBuffer(buff, welcome, length);
+  screenWrite(welcome, length);
 
   E.splashScreen = false;
 }
@@ -281,10 +329,14 @@ void adjustSidebarWidth(void) {
 }
 
 void fixCursorXPosition(void) {
-  E.cursorX = min(E.cursorX, max(0, E.lines[E.cursorY].length + (E.mode == NORMAL ? -1 : 0)));
+  E.cursorX = min(E.cursorX, max(0, editorLineLength(E.cursorY) + (E.mode == NORMAL ? -1 : 0)));
 }
 
 void moveCursorToLine(long lineNumber) {
+  // Lines past the end may just not be indexed yet
+  if (lineNumber > E.numlines)
+    editorLoadIndexedLines();
+
   E.cursorY = clamp(1, lineNumber, E.numlines) - 1;
   E.cursorX = E.highestLastX;
   fixCursorXPosition();
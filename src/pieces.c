@@ -0,0 +1,333 @@
+#define _DEFAULT_SOURCE
+
+#include <highlight.h>
+#include <highlighter.h>
+#include <lines.h>
+#include <pieces.h>
+#include <saver.h>
+#include <scanner.h>
+#include <searcher.h>
+#include <slab.h>
+#include <sys/mman.h>
+
+unsigned int piecePriority(void) {
+  static unsigned int seed = 2463534242u;
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+int pieceTotal(linePiece *piece) {
+  return piece ? piece->total : 0;
+}
+
+void pieceUpdate(linePiece *piece) {
+  piece->total = pieceTotal(piece->left) + piece->count + pieceTotal(piece->right);
+}
+
+linePiece *pieceCreate(bool isOriginal, int start, int count, unsigned int priority) {
+  linePiece *piece = malloc(sizeof(linePiece));
+  piece->isOriginal = isOriginal;
+  piece->start = start;
+  piece->count = count;
+  piece->total = count;
+  piece->priority = priority;
+  piece->left = piece->right = NULL;
+  return piece;
+}
+
+// Splits the tree so that 'left' holds its first 'at' lines and 'right' the rest
+void pieceSplit(linePiece *piece, int at, linePiece **left, linePiece **right) {
+  if (piece == NULL) {
+    *left = *right = NULL;
+    return;
+  }
+
+  int leftTotal = pieceTotal(piece->left);
+
+  if (at <= leftTotal) {
+    pieceSplit(piece->left, at, left, &piece->left);
+    pieceUpdate(piece);
+    *right = piece;
+  }
+  else if (at >= leftTotal + piece->count) {
+    pieceSplit(piece->right, at - leftTotal - piece->count, &piece->right, right);
+    pieceUpdate(piece);
+    *left = piece;
+  }
+  else {
+    // The cut falls inside this piece, so it is broken in two
+    int cut = at - leftTotal;
+    linePiece *tail = pieceCreate(piece->isOriginal, piece->start + cut, piece->count - cut, piece->priority);
+    tail->right = piece->right;
+    piece->right = NULL;
+    piece->count = cut;
+    pieceUpdate(tail);
+    pieceUpdate(piece);
+    *left = piece;
+    *right = tail;
+  }
+}
+
+linePiece *pieceMerge(linePiece *left, linePiece *right) {
+  if (left == NULL) return right;
+  if (right == NULL) return left;
+
+  if (left->priority > right->priority) {
+    left->right = pieceMerge(left->right, right);
+    pieceUpdate(left);
+    return left;
+  }
+
+  right->left = pieceMerge(left, right->left);
+  pieceUpdate(right);
+  return right;
+}
+
+void pieceDestroy(linePiece *piece, bool freeLines) {
+  if (piece == NULL) return;
+
+  pieceDestroy(piece->left, freeLines);
+  pieceDestroy(piece->right, freeLines);
+
+  if (freeLines && !piece->isOriginal) {
+    for (int i = 0; i < piece->count; i++) {
+      editorFreeLine(addedLine(piece->start + i));
+      addedRelease(piece->start + i);
+    }
+  }
+  free(piece);
+}
+
+void pieceVisit(linePiece *piece, void (*visit)(linePiece *, void *), void *arg) {
+  if (piece == NULL) return;
+
+  pieceVisit(piece->left, visit, arg);
+  visit(piece, arg);
+  pieceVisit(piece->right, visit, arg);
+}
+
+linePiece *piecesFind(int at, int *offset) {
+  linePiece *piece = E.pieces;
+
+  while (piece) {
+    int leftTotal = pieceTotal(piece->left);
+
+    if (at < leftTotal) {
+      piece = piece->left;
+    }
+    else if (at < leftTotal + piece->count) {
+      *offset = at - leftTotal;
+      return piece;
+    }
+    else {
+      at -= leftTotal + piece->count;
+      piece = piece->right;
+    }
+  }
+  return NULL;
+}
+
+void piecesInsert(int at, bool isOriginal, int start, int count) {
+  linePiece *left, *right;
+  pieceSplit(E.pieces, at, &left, &right);
+
+  // Lines stored right after the previous piece simply extend it
+  linePiece *last = left;
+  while (last && last->right)
+    last = last->right;
+
+  if (last && last->isOriginal == isOriginal && last->start + last->count == start) {
+    for (linePiece *piece = left; piece; piece = piece->right)
+      piece->total += count;
+    last->count += count;
+    E.pieces = pieceMerge(left, right);
+    return;
+  }
+
+  linePiece *piece = pieceCreate(isOriginal, start, count, piecePriority());
+  E.pieces = pieceMerge(left, pieceMerge(piece, right));
+}
+
+void piecesRemove(int at, int count, bool freeLines) {
+  linePiece *left, *middle, *right;
+  pieceSplit(E.pieces, at, &left, &middle);
+  pieceSplit(middle, count, &middle, &right);
+
+  pieceDestroy(middle, freeLines);
+  E.pieces = pieceMerge(left, right);
+}
+
+void piecesTraverse(void (*visit)(linePiece *, void *), void *arg) {
+  pieceVisit(E.pieces, visit, arg);
+}
+
+void piecesFree(void) {
+  highlighterCancel();
+  saverWait();
+  searcherCancel();
+
+  // Lines are not freed one by one, their storage goes all at once
+  pieceDestroy(E.pieces, false);
+  E.pieces = NULL;
+  E.gap.line = NULL;
+
+  highlightFreeScratch();
+  slabRelease();
+
+  for (int i = 0; i < E.added.numblocks; i++)
+    free(E.added.blocks[i]);
+  free(E.added.blocks);
+  free(E.added.freed);
+  E.added.blocks = NULL;
+  E.added.freed = NULL;
+  E.added.numblocks = E.added.size = E.added.numfreed = 0;
+
+  if (E.original.indexer.isRunning) {
+    pthread_cancel(E.original.indexer.thread);
+    pthread_join(E.original.indexer.thread, NULL);
+    E.original.indexer.isRunning = false;
+  }
+
+  if (E.original.isMapped)
+    munmap(E.original.content, E.original.length);
+  else
+    free(E.original.content);
+  lineIndexFree(&E.original.index);
+  lineIndexFree(&E.original.indexer.index);
+  E.original.content = NULL;
+  E.original.length = 0;
+  E.original.indexed = 0;
+}
+
+int addedAlloc(void) {
+  if (E.added.numfreed)
+    return E.added.freed[--E.added.numfreed];
+
+  if (E.added.size == E.added.numblocks * ADDED_BLOCK_SIZE) {
+    E.added.numblocks++;
+    E.added.blocks = realloc(E.added.blocks, sizeof(editorLine *) * E.added.numblocks);
+    E.added.blocks[E.added.numblocks - 1] = malloc(sizeof(editorLine) * ADDED_BLOCK_SIZE);
+    E.added.freed = realloc(E.added.freed, sizeof(int) * E.added.numblocks * ADDED_BLOCK_SIZE);
+  }
+  return E.added.size++;
+}
+
+// Takes count consecutive slots, so that their lines make up one piece
+int addedAllocRun(int count) {
+  int first = E.added.size;
+  int numblocks = (first + count + ADDED_BLOCK_SIZE - 1) / ADDED_BLOCK_SIZE;
+
+  if (numblocks > E.added.numblocks) {
+    E.added.blocks = realloc(E.added.blocks, sizeof(editorLine *) * numblocks);
+    for (int i = E.added.numblocks; i < numblocks; i++)
+      E.added.blocks[i] = malloc(sizeof(editorLine) * ADDED_BLOCK_SIZE);
+
+    E.added.numblocks = numblocks;
+    E.added.freed = realloc(E.added.freed, sizeof(int) * numblocks * ADDED_BLOCK_SIZE);
+  }
+
+  E.added.size += count;
+  return first;
+}
+
+editorLine *addedLine(int slot) {
+  return &E.added.blocks[slot / ADDED_BLOCK_SIZE][slot % ADDED_BLOCK_SIZE];
+}
+
+void addedRelease(int slot) {
+  E.added.freed[E.added.numfreed++] = slot;
+}
+
+// Indexes the lines of the original buffer found in [from, end)
+void originalScan(lineIndex *index, size_t from, size_t end) {
+  if (from < end)
+    lineIndexPush(index, from);
+
+  for (size_t pos = from; pos < end; pos += BACKGROUND_INDEX_SIZE) {
+    size_t to = pos + BACKGROUND_INDEX_SIZE < end ? pos + BACKGROUND_INDEX_SIZE : end;
+    scanLines(index, E.original.content, pos, to, end);
+    pthread_testcancel();
+  }
+}
+
+void *originalIndexer(void *arg) {
+  (void)arg;
+  originalScan(&E.original.indexer.index, E.original.indexed, E.original.length);
+  write(E.wakeup[1], "i", 1);
+  return NULL;
+}
+
+void originalLoad(char *content, size_t length, bool isMapped) {
+  E.original.content = content;
+  E.original.length = length;
+  E.original.isMapped = isMapped;
+
+  // Big files only get their first lines indexed up front, which is enough
+  // to draw the first screen; the rest is scanned by a background thread
+  size_t end = length;
+  if (length > BACKGROUND_INDEX_SIZE) {
+    char *newline = memchr(content + BACKGROUND_INDEX_SIZE, LINE_FEED, length - BACKGROUND_INDEX_SIZE);
+    end = newline ? (size_t)(newline - content) + 1 : length;
+  }
+
+  originalScan(&E.original.index, 0, end);
+  E.original.indexed = end;
+
+  if (end < length) {
+    E.original.indexer.isRunning = pthread_create(&E.original.indexer.thread, NULL, originalIndexer, NULL) == 0;
+
+    if (!E.original.indexer.isRunning) {
+      originalScan(&E.original.index, end, length);
+      E.original.indexed = length;
+    }
+  }
+}
+
+int originalIndexFinish(void) {
+  if (!E.original.indexer.isRunning)
+    return 0;
+
+  pthread_join(E.original.indexer.thread, NULL);
+  E.original.indexer.isRunning = false;
+
+  int count = E.original.indexer.index.numlines;
+  lineIndexAppend(&E.original.index, &E.original.indexer.index);
+  lineIndexFree(&E.original.indexer.index);
+  E.original.indexed = E.original.length;
+
+  return count;
+}
+
+bool originalIsCRLF(void) {
+  return E.original.index.crlf && 2 * E.original.index.crlf >= E.original.index.numlines;
+}
+
+int originalLineTabs(int line) {
+  return E.original.index.tabs[line];
+}
+
+// Returns lines [line, line + count) exactly as they are laid out in the file
+char *originalLinesContent(int line, int count, size_t *length) {
+  size_t start = lineIndexOffset(&E.original.index, line);
+  size_t end = line + count < E.original.index.numlines
+    ? lineIndexOffset(&E.original.index, line + count)
+    : E.original.indexed;
+
+  *length = end - start;
+  return &E.original.content[start];
+}
+
+char *originalLineContent(int line, int *length) {
+  size_t end;
+  char *content = originalLinesContent(line, 1, &end);
+  size_t start = content - E.original.content;
+  end += start;
+
+  while (end > start && (E.original.content[end - 1] == LINE_FEED || E.original.content[end - 1] == RETURN))
+    end--;
+
+  *length = end - start;
+  return &E.original.content[start];
+}
@@ -0,0 +1,794 @@
+#define _GNU_SOURCE
+
+#include <regexp.h>
+
+// Regular expressions are parsed to a tree, compiled to an NFA for either
+// direction and run as DFAs made from those a state at a time, as the text
+// needs them, so a scan takes a table lookup per byte whatever the pattern.
+// A match is found with three scans of the text: forward to the first line
+// holding one, back from the end of that line to where the leftmost one
+// starts, and forward again from there to its longest end. Matches never
+// run across lines
+
+void regexpSetAdd(regexpSet *set, unsigned char c) {
+  set->bits[c >> 5] |= 1u << (c & 31);
+}
+
+bool regexpSetHas(regexpSet *set, unsigned char c) {
+  return set->bits[c >> 5] >> (c & 31) & 1;
+}
+
+void regexpSetRange(regexpSet *set, int from, int to) {
+  for (int c = from; c <= to; c++)
+    regexpSetAdd(set, c);
+}
+
+// Line breaks are never part of a match, and neither is a carriage return,
+// which '.' would otherwise take from the end of a CRLF line
+void regexpSetInvert(regexpSet *set) {
+  for (int i = 0; i < 8; i++)
+    set->bits[i] = ~set->bits[i];
+  set->bits['\n' >> 5] &= ~(1u << ('\n' & 31));
+  set->bits['\r' >> 5] &= ~(1u << ('\r' & 31));
+}
+
+// Adds the bytes of a class escape like \d or \S, returning false for any
+// other escape
+bool regexpEscapeClass(regexpSet *set, char c) {
+  regexpSet class = {{0}};
+
+  switch (tolower((unsigned char)c)) {
+    case 'd':
+      regexpSetRange(&class, '0', '9');
+      break;
+
+    case 'w':
+      regexpSetRange(&class, '0', '9');
+      regexpSetRange(&class, 'a', 'z');
+      regexpSetRange(&class, 'A', 'Z');
+      regexpSetAdd(&class, '_');
+      break;
+
+    case 's':
+      for (const char *space = " \t\r\f\v"; *space; space++)
+        regexpSetAdd(&class, *space);
+      break;
+
+    default:
+      return false;
+  }
+
+  if (isupper((unsigned char)c))
+    regexpSetInvert(&class);
+
+  for (int i = 0; i < 8; i++)
+    set->bits[i] |= class.bits[i];
+  return true;
+}
+
+char regexpEscapeByte(char c) {
+  switch (c) {
+    case 't': return '\t';
+    case 'r': return '\r';
+    case 'f': return '\f';
+    case 'v': return '\v';
+    default: return c;
+  }
+}
+
+int regexpAddNode(regexpParser *parser, regexpNode node) {
+  if (parser->numnodes == parser->capacity) {
+    parser->capacity = parser->capacity ? parser->capacity * 2 : 32;
+    parser->nodes = realloc(parser->nodes, sizeof(regexpNode) * parser->capacity);
+  }
+
+  parser->nodes[parser->numnodes] = node;
+  return parser->numnodes++;
+}
+
+int regexpAddSet(regexpParser *parser, regexpSet *set) {
+  regexpProgram *program = parser->program;
+  program->sets = realloc(program->sets, sizeof(regexpSet) * (program->numsets + 1));
+  program->sets[program->numsets] = *set;
+
+  return regexpAddNode(parser, (regexpNode){REGEXP_SET, -1, -1, program->numsets++, 0, 0});
+}
+
+// Reads a byte of a bracket class, returning false when it was a class
+// escape, which went into the set instead
+bool regexpParseClassByte(regexpParser *parser, regexpSet *set, unsigned char *byte) {
+  char c = *parser->at++;
+
+  if (c == '\\' && *parser->at != '\0') {
+    c = *parser->at++;
+    if (regexpEscapeClass(set, c)) return false;
+    c = regexpEscapeByte(c);
+  }
+
+  *byte = c;
+  return true;
+}
+
+int regexpParseClass(regexpParser *parser) {
+  regexpSet set = {{0}};
+  bool isNegated = *parser->at == '^';
+  if (isNegated) parser->at++;
+
+  // A bracket right at the start is taken literally
+  char *first = parser->at;
+
+  while (*parser->at != ']' || parser->at == first) {
+    if (*parser->at == '\0') {
+      parser->error = "Missing ]";
+      return -1;
+    }
+
+    unsigned char from, to;
+    if (!regexpParseClassByte(parser, &set, &from)) continue;
+    to = from;
+
+    if (parser->at[0] == '-' && parser->at[1] != ']' && parser->at[1] != '\0') {
+      parser->at++;
+      if (!regexpParseClassByte(parser, &set, &to) || to < from) {
+        parser->error = "Bad range";
+        return -1;
+      }
+    }
+
+    regexpSetRange(&set, from, to);
+  }
+  parser->at++;
+
+  if (isNegated)
+    regexpSetInvert(&set);
+  return regexpAddSet(parser, &set);
+}
+
+int regexpParseAlternation(regexpParser *parser);
+
+int regexpParseAtom(regexpParser *parser) {
+  char c = *parser->at++;
+  regexpSet set = {{0}};
+
+  switch (c) {
+    case '(': {
+      int node = regexpParseAlternation(parser);
+      if (parser->error) return -1;
+
+      if (*parser->at != ')') {
+        parser->error = "Missing )";
+        return -1;
+      }
+      parser->at++;
+      return node;
+    }
+
+    case '[':
+      return regexpParseClass(parser);
+
+    case '.':
+      regexpSetInvert(&set);
+      return regexpAddSet(parser, &set);
+
+    case '^':
+      return regexpAddNode(parser, (regexpNode){REGEXP_LINE_START, -1, -1, -1, 0, 0});
+
+    case '$':
+      return regexpAddNode(parser, (regexpNode){REGEXP_LINE_END, -1, -1, -1, 0, 0});
+
+    case '*':
+    case '+':
+    case '?':
+      parser->error = "Nothing to repeat";
+      return -1;
+
+    case '\\':
+      if (*parser->at == '\0') {
+        parser->error = "Trailing \\";
+        return -1;
+      }
+
+      c = *parser->at++;
+      if (regexpEscapeClass(&set, c))
+        return regexpAddSet(parser, &set);
+      c = regexpEscapeByte(c);
+      break;
+  }
+
+  regexpSetAdd(&set, c);
+  return regexpAddSet(parser, &set);
+}
+
+// Reads a count like {2}, {2,} or {2,5}, leaving a brace that does not
+// start one to be taken literally
+bool regexpParseCount(regexpParser *parser, int *min, int *max) {
+  char *at = parser->at + 1;
+  if (!isdigit((unsigned char)*at)) return false;
+
+  long low = strtol(at, &at, 10), high = low;
+  if (*at == ',') {
+    at++;
+    high = isdigit((unsigned char)*at) ? strtol(at, &at, 10) : -1;
+  }
+  if (*at != '}') return false;
+
+  parser->at = at + 1;
+
+  if (low > REGEXP_MAX_REPEAT || high > REGEXP_MAX_REPEAT)
+    parser->error = "Repeat count too big";
+  else if (high != -1 && high < low)
+    parser->error = "Bad repeat count";
+
+  *min = low;
+  *max = high;
+  return true;
+}
+
+int regexpParseRepeat(regexpParser *parser) {
+  int node = regexpParseAtom(parser);
+
+  while (!parser->error) {
+    int min, max;
+    char c = *parser->at;
+
+    if (c == '{') {
+      if (!regexpParseCount(parser, &min, &max)) break;
+    }
+    else if (c == '*' || c == '+' || c == '?') {
+      min = c == '+';
+      max = c == '?' ? 1 : -1;
+      parser->at++;
+    }
+    else {
+      break;
+    }
+
+    node = regexpAddNode(parser, (regexpNode){REGEXP_REPEAT, node, -1, -1, min, max});
+  }
+
+  return node;
+}
+
+int regexpParseConcat(regexpParser *parser) {
+  int node = -1;
+
+  while (!parser->error && *parser->at && *parser->at != '|' && *parser->at != ')') {
+    int next = regexpParseRepeat(parser);
+    node = node == -1 ? next : regexpAddNode(parser, (regexpNode){REGEXP_CONCAT, node, next, -1, 0, 0});
+  }
+
+  return node == -1
+    ? regexpAddNode(parser, (regexpNode){REGEXP_EMPTY, -1, -1, -1, 0, 0})
+    : node;
+}
+
+int regexpParseAlternation(regexpParser *parser) {
+  int node = regexpParseConcat(parser);
+
+  while (!parser->error && *parser->at == '|') {
+    parser->at++;
+    int right = regexpParseConcat(parser);
+    node = regexpAddNode(parser, (regexpNode){REGEXP_ALTERNATE, node, right, -1, 0, 0});
+  }
+
+  return node;
+}
+
+int regexpAddState(regexpNfa *nfa, regexpState state) {
+  if (nfa->count == nfa->capacity) {
+    nfa->capacity = nfa->capacity ? nfa->capacity * 2 : 64;
+    nfa->states = realloc(nfa->states, sizeof(regexpState) * nfa->capacity);
+  }
+
+  nfa->states[nfa->count] = state;
+  return nfa->count++;
+}
+
+int regexpCompileNode(regexpParser *parser, regexpNfa *nfa, int index, int next, bool isReverse);
+
+// Copies past the minimum are optional, nested so that each needs the one
+// before it; with no maximum, a single one loops
+int regexpCompileRepeat(regexpParser *parser, regexpNfa *nfa, regexpNode *node, int next, bool isReverse) {
+  int end = next;
+
+  if (node->max == -1) {
+    int split = regexpAddState(nfa, (regexpState){REGEXP_SPLIT, -1, -1, end});
+    int body = regexpCompileNode(parser, nfa, node->left, split, isReverse);
+    if (body < 0) return -1;
+
+    nfa->states[split].next = body;
+    next = split;
+  }
+  else {
+    for (int i = node->min; i < node->max && next >= 0; i++) {
+      int body = regexpCompileNode(parser, nfa, node->left, next, isReverse);
+      next = body < 0 ? -1 : regexpAddState(nfa, (regexpState){REGEXP_SPLIT, -1, body, end});
+    }
+  }
+
+  for (int i = 0; i < node->min && next >= 0; i++)
+    next = regexpCompileNode(parser, nfa, node->left, next, isReverse);
+  return next;
+}
+
+// Compiles a node to states that go on to 'next' once it matched, and
+// returns the first of them, or -1 when the automaton gets too big
+int regexpCompileNode(regexpParser *parser, regexpNfa *nfa, int index, int next, bool isReverse) {
+  if (next < 0 || nfa->count >= REGEXP_MAX_STATES) return -1;
+
+  regexpNode *node = &parser->nodes[index];
+
+  switch (node->kind) {
+    case REGEXP_SET:
+      return regexpAddState(nfa, (regexpState){REGEXP_SET, node->set, next, -1});
+
+    // Going backwards, a line is entered at its end
+    case REGEXP_LINE_START:
+    case REGEXP_LINE_END: {
+      int kind = isReverse ? REGEXP_LINE_START + REGEXP_LINE_END - node->kind : node->kind;
+      return regexpAddState(nfa, (regexpState){kind, -1, next, -1});
+    }
+
+    case REGEXP_CONCAT:
+      return isReverse
+        ? regexpCompileNode(parser, nfa, node->right, regexpCompileNode(parser, nfa, node->left, next, isReverse), isReverse)
+        : regexpCompileNode(parser, nfa, node->left, regexpCompileNode(parser, nfa, node->right, next, isReverse), isReverse);
+
+    case REGEXP_ALTERNATE: {
+      int left = regexpCompileNode(parser, nfa, node->left, next, isReverse);
+      int right = regexpCompileNode(parser, nfa, node->right, next, isReverse);
+      if (left < 0 || right < 0) return -1;
+      return regexpAddState(nfa, (regexpState){REGEXP_SPLIT, -1, left, right});
+    }
+
+    case REGEXP_REPEAT:
+      return regexpCompileRepeat(parser, nfa, node, next, isReverse);
+
+    default:
+      return next;
+  }
+}
+
+bool regexpCompileNfa(regexpParser *parser, regexpNfa *nfa, int root, bool isReverse) {
+  nfa->match = regexpAddState(nfa, (regexpState){REGEXP_MATCH, -1, -1, -1});
+  nfa->start = regexpCompileNode(parser, nfa, root, nfa->match, isReverse);
+  return nfa->start >= 0;
+}
+
+// Collects the states reachable from 'from' without reading a byte: sets
+// waiting for one, the match, and line end assertions unless the line ends
+// here, in which case they are passed
+int regexpClosure(regexpDfa *dfa, int *from, int count, int *out, bool isLineStart, bool isLineEnd) {
+  regexpState *states = dfa->nfa->states;
+  int *stack = dfa->stack;
+  int top = 0, length = 0;
+
+  if (++dfa->generation == 0) {
+    memset(dfa->marks, 0, sizeof(unsigned int) * dfa->nfa->count);
+    dfa->generation = 1;
+  }
+
+  for (int i = count - 1; i >= 0; i--)
+    stack[top++] = from[i];
+
+  while (top > 0) {
+    int index = stack[--top];
+    if (dfa->marks[index] == dfa->generation) continue;
+    dfa->marks[index] = dfa->generation;
+
+    regexpState *state = &states[index];
+
+    switch (state->kind) {
+      case REGEXP_SPLIT:
+        stack[top++] = state->alternate;
+        stack[top++] = state->next;
+        break;
+
+      case REGEXP_LINE_START:
+        if (isLineStart) stack[top++] = state->next;
+        break;
+
+      case REGEXP_LINE_END:
+        if (isLineEnd)
+          stack[top++] = state->next;
+        else
+          out[length++] = index;
+        break;
+
+      default:
+        out[length++] = index;
+        break;
+    }
+  }
+
+  return length;
+}
+
+void regexpDfaFlush(regexpDfa *dfa) {
+  for (int i = 0; i < dfa->numstates; i++)
+    free(dfa->states[i].states);
+
+  dfa->numstates = 0;
+  for (int i = 0; i < 2 * REGEXP_DFA_STATES; i++)
+    dfa->table[i] = -1;
+
+  dfa->starts[0] = dfa->starts[1] = -1;
+  dfa->flushes++;
+}
+
+void regexpDfaInit(regexpDfa *dfa, regexpNfa *nfa, regexpSet *sets, bool isUnanchored) {
+  dfa->nfa = nfa;
+  dfa->sets = sets;
+  dfa->isUnanchored = isUnanchored;
+  dfa->states = NULL;
+  dfa->numstates = dfa->capacity = 0;
+  dfa->table = malloc(sizeof(int) * 2 * REGEXP_DFA_STATES);
+  dfa->numstops = -1;
+  dfa->flushes = 0;
+  dfa->marks = calloc(nfa->count, sizeof(unsigned int));
+  dfa->generation = 0;
+
+  // A closure pushes every state at most twice past those it starts from
+  dfa->stack = malloc(sizeof(int) * (3 * nfa->count + 1));
+  dfa->moved = malloc(sizeof(int) * (nfa->count + 1));
+  dfa->closure = malloc(sizeof(int) * (nfa->count + 1));
+
+  regexpDfaFlush(dfa);
+}
+
+void regexpDfaFree(regexpDfa *dfa) {
+  for (int i = 0; i < dfa->numstates; i++)
+    free(dfa->states[i].states);
+
+  free(dfa->states);
+  free(dfa->table);
+  free(dfa->marks);
+  free(dfa->stack);
+  free(dfa->moved);
+  free(dfa->closure);
+}
+
+int regexpCompareStates(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+// Returns the DFA state for a set of NFA states, making it if it is new.
+// Making it may throw away all the others
+int regexpDfaIntern(regexpDfa *dfa, int *set, int count) {
+  qsort(set, count, sizeof(int), regexpCompareStates);
+
+  unsigned int hash = 2166136261u;
+  for (int i = 0; i < count; i++)
+    hash = (hash ^ (unsigned int)set[i]) * 16777619u;
+
+  unsigned int mask = 2 * REGEXP_DFA_STATES - 1;
+  unsigned int slot = hash & mask;
+
+  for (; dfa->table[slot] != -1; slot = (slot + 1) & mask) {
+    regexpDfaState *state = &dfa->states[dfa->table[slot]];
+    if (state->hash == hash && state->count == count && !memcmp(state->states, set, sizeof(int) * count))
+      return dfa->table[slot];
+  }
+
+  if (dfa->numstates == REGEXP_DFA_STATES) {
+    regexpDfaFlush(dfa);
+    slot = hash & mask;
+  }
+
+  if (dfa->numstates == dfa->capacity) {
+    dfa->capacity = dfa->capacity ? dfa->capacity * 2 : 16;
+    dfa->states = realloc(dfa->states, sizeof(regexpDfaState) * dfa->capacity);
+  }
+
+  int index = dfa->numstates++;
+  regexpDfaState *state = &dfa->states[index];
+  state->states = malloc(sizeof(int) * (count + 1));
+  memcpy(state->states, set, sizeof(int) * count);
+  state->count = count;
+  state->hash = hash;
+  memset(state->next, -1, sizeof(state->next));
+
+  state->isMatch = false;
+  for (int i = 0; i < count; i++)
+    state->isMatch |= set[i] == dfa->nfa->match;
+
+  // Line end assertions are only passed where the line ends
+  int length = regexpClosure(dfa, state->states, count, dfa->moved, false, true);
+  state->isMatchAtEnd = false;
+  for (int i = 0; i < length; i++)
+    state->isMatchAtEnd |= dfa->moved[i] == dfa->nfa->match;
+
+  dfa->table[slot] = index;
+  return index;
+}
+
+int regexpDfaStart(regexpDfa *dfa, bool isLineStart) {
+  if (dfa->starts[isLineStart] == -1) {
+    int count = regexpClosure(dfa, &dfa->nfa->start, 1, dfa->closure, isLineStart, false);
+    int start = regexpDfaIntern(dfa, dfa->closure, count);
+    dfa->starts[isLineStart] = start;
+  }
+
+  return dfa->starts[isLineStart];
+}
+
+// Makes the transition of a state on a byte. A DFA looking for a match
+// anywhere starts one more at every byte
+int regexpDfaStep(regexpDfa *dfa, int from, unsigned char c) {
+  regexpDfaState *state = &dfa->states[from];
+  regexpState *states = dfa->nfa->states;
+  int count = 0;
+
+  for (int i = 0; i < state->count; i++) {
+    regexpState *nfaState = &states[state->states[i]];
+    if (nfaState->kind == REGEXP_SET && regexpSetHas(&dfa->sets[nfaState->set], c))
+      dfa->moved[count++] = nfaState->next;
+  }
+
+  if (dfa->isUnanchored)
+    dfa->moved[count++] = dfa->nfa->start;
+
+  count = regexpClosure(dfa, dfa->moved, count, dfa->closure, false, false);
+
+  unsigned int flushes = dfa->flushes;
+  int to = regexpDfaIntern(dfa, dfa->closure, count);
+
+  if (flushes == dfa->flushes)
+    dfa->states[from].next[c] = to;
+  return to;
+}
+
+int regexpDfaNext(regexpDfa *dfa, int state, unsigned char c) {
+  int next = dfa->states[state].next[c];
+  return next >= 0 ? next : regexpDfaStep(dfa, state, c);
+}
+
+bool regexpIsLineBreak(char *text, size_t at, size_t length) {
+  return text[at] == '\n' || (text[at] == '\r' && at + 1 < length && text[at + 1] == '\n');
+}
+
+size_t regexpLineEnd(char *text, size_t from, size_t length) {
+  char *end = memchr(text + from, '\n', length - from);
+  if (end == NULL) return length;
+
+  size_t at = end - text;
+  return at > from && text[at - 1] == '\r' ? at - 1 : at;
+}
+
+// Walks back from the end of a line, where every match in it has been
+// read, to the start of the leftmost one
+size_t regexpLeftmost(regexpProgram *program, char *text, size_t lineStart, size_t lineEnd, bool isLineStart) {
+  regexpDfa *dfa = &program->backward;
+  int state = regexpDfaStart(dfa, true);
+  size_t start = lineEnd;
+
+  for (size_t at = lineEnd; ; at--) {
+    regexpDfaState *current = &dfa->states[state];
+    if (at == lineStart && isLineStart ? current->isMatchAtEnd : current->isMatch)
+      start = at;
+
+    if (at == lineStart) return start;
+    state = regexpDfaNext(dfa, state, text[at - 1]);
+  }
+}
+
+// Follows the match starting at 'start' to its longest end
+size_t regexpLongest(regexpProgram *program, char *text, size_t start, size_t lineEnd, bool isLineStart) {
+  regexpDfa *dfa = &program->longest;
+  int state = regexpDfaStart(dfa, isLineStart);
+  size_t end = start;
+
+  for (size_t at = start; ; at++) {
+    regexpDfaState *current = &dfa->states[state];
+    if (at == lineEnd ? current->isMatchAtEnd : current->isMatch)
+      end = at;
+
+    if (at == lineEnd || current->count == 0) return end;
+    state = regexpDfaNext(dfa, state, text[at]);
+  }
+}
+
+// Finds the bytes that take a scan looking for a match anywhere out of its
+// start state, if there are only a few, so that it can jump from one to the
+// next while nothing else happens. Line breaks are jumped over too, unless
+// a line start or end makes a difference
+void regexpDfaAccelerate(regexpDfa *dfa) {
+  if (dfa->numstops != -1) return;
+  dfa->numstops = REGEXP_MAX_STOPS + 1;
+
+  int idle = regexpDfaStart(dfa, false);
+  regexpDfaState *state = &dfa->states[idle];
+  if (idle != regexpDfaStart(dfa, true) || state->isMatch || state->isMatchAtEnd) return;
+
+  int count = 0;
+  for (int c = 0; c < 256; c++) {
+    if (c == '\n') continue;
+
+    idle = regexpDfaStart(dfa, false);
+    if (regexpDfaNext(dfa, idle, c) == regexpDfaStart(dfa, false)) continue;
+
+    if (count == REGEXP_MAX_STOPS) return;
+    dfa->stops[count++] = c;
+  }
+
+  dfa->numstops = count;
+}
+
+// Returns the first stop in text[0, length), or NULL
+char *regexpNextStop(regexpDfa *dfa, char *text, size_t length) {
+  char *found = NULL;
+
+  for (int i = 0; i < dfa->numstops; i++) {
+    char *stop = memchr(text, dfa->stops[i], found ? (size_t)(found - text) : length);
+    if (stop) found = stop;
+  }
+  return found;
+}
+
+// Returns the last stop in text[0, length), or NULL
+char *regexpPreviousStop(regexpDfa *dfa, char *text, size_t length) {
+  char *found = NULL;
+
+  for (int i = 0; i < dfa->numstops; i++) {
+    size_t from = found ? (size_t)(found - text) + 1 : 0;
+    char *stop = memrchr(text + from, dfa->stops[i], length - from);
+    if (stop) found = stop;
+  }
+  return found;
+}
+
+// Returns the first match in text[0, length), which holds whole lines but
+// for the first one when it does not start at a line start, or NULL
+char *regexpNext(regexpProgram *program, char *text, size_t length, bool isLineStart, size_t *matchLength) {
+  regexpDfa *dfa = &program->search;
+  regexpDfaAccelerate(dfa);
+
+  int state = regexpDfaStart(dfa, isLineStart);
+  int idle = regexpDfaStart(dfa, false);
+  size_t at = 0;
+
+  while (true) {
+    bool isLineEnd = at == length || regexpIsLineBreak(text, at, length);
+    regexpDfaState *current = &dfa->states[state];
+
+    if (isLineEnd ? current->isMatchAtEnd : current->isMatch) break;
+    if (at == length) return NULL;
+
+    if (isLineEnd) {
+      at += text[at] == '\r' ? 2 : 1;
+
+      // Past a final line break there is no line left
+      if (at == length) return NULL;
+      state = regexpDfaStart(dfa, true);
+      continue;
+    }
+
+    if (state == idle && dfa->numstops <= REGEXP_MAX_STOPS) {
+      char *stop = regexpNextStop(dfa, text + at, length - at);
+      at = stop ? (size_t)(stop - text) : length;
+      if (at == length || regexpIsLineBreak(text, at, length)) continue;
+    }
+
+    unsigned char c = text[at++];
+    int next = dfa->states[state].next[c];
+
+    if (next < 0) {
+      next = regexpDfaStep(dfa, state, c);
+      idle = regexpDfaStart(dfa, false);
+    }
+    state = next;
+  }
+
+  // The match ends on the line the scan stopped at
+  size_t lineStart = at;
+  while (lineStart > 0 && text[lineStart - 1] != '\n')
+    lineStart--;
+
+  isLineStart = isLineStart || lineStart > 0;
+  size_t lineEnd = regexpLineEnd(text, at, length);
+  size_t start = regexpLeftmost(program, text, lineStart, lineEnd, isLineStart);
+
+  *matchLength = regexpLongest(program, text, start, lineEnd, isLineStart && start == lineStart) - start;
+  return text + start;
+}
+
+// Returns the last match starting before 'limit' in text[0, length), which
+// holds whole lines, or NULL. The match may go on past 'limit'
+char *regexpPrevious(regexpProgram *program, char *text, size_t length, size_t limit, size_t *matchLength) {
+  regexpDfa *dfa = &program->backward;
+  regexpDfaAccelerate(dfa);
+
+  int state = regexpDfaStart(dfa, true);
+  int idle = regexpDfaStart(dfa, false);
+  size_t at = length;
+
+  if (at > 0 && text[at - 1] == '\n') at--;
+  if (at > 0 && at < length && text[at - 1] == '\r') at--;
+
+  while (true) {
+    bool isLineStart = at == 0 || text[at - 1] == '\n';
+    regexpDfaState *current = &dfa->states[state];
+
+    if (at < limit && (isLineStart ? current->isMatchAtEnd : current->isMatch)) {
+      size_t lineEnd = regexpLineEnd(text, at, length);
+      *matchLength = regexpLongest(program, text, at, lineEnd, isLineStart) - at;
+      return text + at;
+    }
+
+    if (at == 0) return NULL;
+
+    if (isLineStart) {
+      at--;
+      if (at > 0 && text[at - 1] == '\r') at--;
+      state = regexpDfaStart(dfa, true);
+      continue;
+    }
+
+    if (state == idle && dfa->numstops <= REGEXP_MAX_STOPS) {
+      char *stop = regexpPreviousStop(dfa, text, at);
+      if (stop == NULL) {
+        at = 0;
+        continue;
+      }
+
+      at = stop - text + 1;
+
+      // A carriage return ending a line is no part of it
+      if (*stop == '\r' && at < length && text[at] == '\n') {
+        at--;
+        continue;
+      }
+    }
+
+    unsigned char c = text[--at];
+    int next = dfa->states[state].next[c];
+
+    if (next < 0) {
+      next = regexpDfaStep(dfa, state, c);
+      idle = regexpDfaStart(dfa, false);
+    }
+    state = next;
+  }
+}
+
+const char *regexpCompile(regexpProgram *program, char *source) {
+  memset(program, 0, sizeof(regexpProgram));
+
+  if (strlen(source) > REGEXP_MAX_LENGTH)
+    return "Pattern too long";
+
+  regexpParser parser = {source, NULL, 0, 0, program, NULL};
+  int root = regexpParseAlternation(&parser);
+
+  if (!parser.error && *parser.at == ')')
+    parser.error = "Unmatched )";
+
+  if (!parser.error &&
+      (!regexpCompileNfa(&parser, &program->forward, root, false) ||
+       !regexpCompileNfa(&parser, &program->reverse, root, true)))
+    parser.error = "Pattern too big";
+
+  free(parser.nodes);
+
+  if (parser.error) {
+    regexpFree(program);
+    return parser.error;
+  }
+
+  regexpDfaInit(&program->search, &program->forward, program->sets, true);
+  regexpDfaInit(&program->longest, &program->forward, program->sets, false);
+  regexpDfaInit(&program->backward, &program->reverse, program->sets, true);
+  return NULL;
+}
+
+void regexpFree(regexpProgram *program) {
+  regexpDfaFree(&program->search);
+  regexpDfaFree(&program->longest);
+  regexpDfaFree(&program->backward);
+
+  free(program->forward.states);
+  free(program->reverse.states);
+  free(program->sets);
+  memset(program, 0, sizeof(regexpProgram));
+}
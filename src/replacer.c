@@ -0,0 +1,243 @@
+#define _DEFAULT_SOURCE
+
+#include <buffer.h>
+#include <finder.h>
+#include <input.h>
+#include <lines.h>
+#include <output.h>
+#include <regexp.h>
+#include <replacer.h>
+#include <searcher.h>
+
+// The command prompt takes substitutions in the form
+//
+//   [range]s/pattern/replacement/[flags]
+//
+// where the range is '%' for the whole buffer, a line or two of them split
+// by a comma, each a number, '.' for the current line or '$' for the last,
+// and the current line when it is left out. The pattern is a regular
+// expression, or taken as it is with the 'l' flag, and every match on a
+// line is replaced with 'g' rather than only the first. In the replacement
+// '&' stands for the match of a regular expression
+//
+// Lines with no match are skipped over as the search does, without being
+// loaded, and every other one is built anew and put back in one go, so the
+// whole of it is undone at once
+
+// Reads up to the next unescaped delimiter, which stops being escaped
+char *replaceSplit(char **at, char delimiter) {
+  char *part = malloc(strlen(*at) + 1);
+  int length = 0;
+  char *c = *at;
+
+  for (; *c && *c != delimiter; c++) {
+    if (*c == '\\' && c[1] == delimiter)
+      c++;
+    else if (*c == '\\' && c[1])
+      part[length++] = *c++;
+    part[length++] = *c;
+  }
+  part[length] = '\0';
+
+  *at = *c ? c + 1 : c;
+  return part;
+}
+
+// Reads a line number of a range, returning it as a row
+bool replaceAddress(char **at, int *row) {
+  if (**at == '.') {
+    (*at)++;
+    *row = E.cursorY;
+  }
+  else if (**at == '$') {
+    (*at)++;
+    *row = E.numlines - 1;
+  }
+  else if (isdigit((unsigned char)**at)) {
+    *row = strtol(*at, at, 10) - 1;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+// Parses a command, returning what is wrong with it when it cannot be run
+const char *replaceParse(char *source, replaceCommand *command) {
+  char *at = source;
+  memset(command, 0, sizeof(replaceCommand));
+
+  // Lines past the ones indexed so far can be given too
+  if (*at != 's') editorLoadIndexedLines();
+
+  if (*at == '%') {
+    at++;
+    command->first = 0;
+    command->last = E.numlines - 1;
+  }
+  else if (replaceAddress(&at, &command->first)) {
+    command->last = command->first;
+    if (*at == ',' && (at++, !replaceAddress(&at, &command->last)))
+      return "Bad range";
+  }
+  else {
+    command->first = command->last = E.cursorY;
+  }
+
+  if (*at++ != 's' || *at == '\0' || isalnum((unsigned char)*at) || *at == '\\' || *at == ' ')
+    return "Not a substitution";
+
+  if (command->first > command->last) {
+    int first = command->first;
+    command->first = command->last;
+    command->last = first;
+  }
+  if (command->first < 0 || command->last >= E.numlines)
+    return "Range out of the buffer";
+
+  char delimiter = *at++;
+  command->query.source = replaceSplit(&at, delimiter);
+  command->replacement = replaceSplit(&at, delimiter);
+  command->query.isRegex = true;
+
+  for (; *at; at++) {
+    if (*at == 'g')
+      command->isGlobal = true;
+    else if (*at == 'l')
+      command->query.isRegex = false;
+    else
+      return "Bad flag";
+  }
+
+  if (*command->query.source == '\0')
+    return "Empty pattern";
+
+  // Taken as it is, the pattern only keeps escaped backslashes
+  if (!command->query.isRegex) {
+    char *from = command->query.source, *to = from;
+    for (; *from; from++) {
+      if (*from == '\\' && from[1] == '\\') from++;
+      *to++ = *from;
+    }
+    *to = '\0';
+  }
+
+  return findQueryCompile(&command->query);
+}
+
+void replaceFree(replaceCommand *command) {
+  regexpFree(&command->query.regex);
+  free(command->query.source);
+  free(command->replacement);
+}
+
+void replaceAppendMatch(replaceCommand *command, buffer *out, char *match, int length) {
+  char *replacement = command->replacement;
+
+  for (char *c = replacement; *c; c++) {
+    if (*c == '\\' && (c[1] == '\\' || c[1] == '&'))
+      c++;
+    else if (*c == '&' && command->query.isRegex) {
+      appendBuffer(out, match, length);
+      continue;
+    }
+    appendBuffer(out, c, 1);
+  }
+}
+
+// Builds the content of the line with its matches replaced, returning how
+// many there were. An empty match right where the last one ended does not
+// count, so that every position is replaced once at most
+int replaceLine(replaceCommand *command, editorLine *line, buffer *out) {
+  char *content = line->content;
+  int at = 0, end = -1, count = 0;
+  int matchLength;
+  char *match;
+
+  out->length = 0;
+
+  while (at <= line->length && (match = findNextIn(&command->query, content + at, line->length - at, at == 0, &matchLength))) {
+    int col = match - content;
+
+    if (matchLength == 0 && col == end) {
+      if (col == line->length) break;
+      appendBuffer(out, content + at, col + 1 - at);
+      at = col + 1;
+      continue;
+    }
+
+    appendBuffer(out, content + at, col - at);
+    replaceAppendMatch(command, out, match, matchLength);
+    count++;
+    at = end = col + matchLength;
+
+    if (!command->isGlobal) break;
+
+    // Past an empty match the next one starts a character later
+    if (matchLength == 0) {
+      if (col == line->length) break;
+      appendBuffer(out, content + col, 1);
+      at++;
+    }
+  }
+
+  if (at < line->length)
+    appendBuffer(out, content + at, line->length - at);
+  return count;
+}
+
+// Replaces the matches of a parsed command, telling how many there were
+// and on how many lines
+void replaceRun(replaceCommand *command, int *total, int *lines) {
+  buffer out = BUFFER_INIT;
+  findMatch match;
+  int row = command->first;
+
+  *total = *lines = 0;
+
+  while (row <= command->last && findForward(&command->query, row, 0, command->last + 1, &match)) {
+    editorLine *line = editorGetLine(match.row);
+    int count = replaceLine(command, line, &out);
+
+    if (count) {
+      editorLineReplaceString(line, out.content ? out.content : "", out.length);
+      *total += count;
+      (*lines)++;
+      E.cursorY = match.row;
+      E.cursorX = 0;
+    }
+    row = match.row + 1;
+  }
+
+  freeBuffer(&out);
+}
+
+void editorReplace(void) {
+  char *source = editorPrompt(":%s", NULL);
+  if (source == NULL) return;
+
+  replaceCommand command;
+  const char *error = replaceParse(source, &command);
+
+  if (error) {
+    editorSetStatusMessage("%s: %s", error, source);
+  }
+  else {
+    // What is being counted would not be there anymore
+    searcherCancel();
+
+    int total, lines;
+    replaceRun(&command, &total, &lines);
+
+    if (total == 0) {
+      editorSetStatusMessage("Pattern not found: %s", command.query.source);
+    }
+    else {
+      E.dirty = true;
+      editorSetStatusMessage("%d substitution%s on %d line%s", total, total == 1 ? "" : "s", lines, lines == 1 ? "" : "s");
+    }
+  }
+
+  replaceFree(&command);
+  free(source);
+}
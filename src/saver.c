@@ -0,0 +1,359 @@
+#define _DEFAULT_SOURCE
+
+#include <fileio.h>
+#include <gap.h>
+#include <journal.h>
+#include <lines.h>
+#include <output.h>
+#include <pieces.h>
+#include <saver.h>
+#include <sys/stat.h>
+#include <tools.h>
+#include <undo.h>
+
+// Saving takes a snapshot of the buffer and hands it to a thread, so the
+// editor keeps going however long the disk takes. Lines of the original
+// file are written straight from the mapping, which stays in place until
+// the thread is done; lines the editor may still change are copied
+
+// Writes out the buffers gathered so far, picking up after partial writes
+void saveFlush(saveBatch *batch) {
+  struct iovec *iov = batch->iov;
+  int count = batch->count;
+  batch->count = 0;
+
+  while (count > 0 && !batch->isFailed) {
+    ssize_t written = writev(batch->fd, iov, count);
+    if (written == -1 && errno == EINTR) continue;
+    if (written <= 0) {
+      batch->isFailed = true;
+      return;
+    }
+
+    batch->written += written;
+
+    while (count > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+
+    if (count > 0) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+
+  // The status bar is only redrawn when the progress shown there changes
+  saveJob *job = batch->job;
+  __atomic_store_n(&job->written, batch->written, __ATOMIC_RELAXED);
+
+  int percent = job->total ? batch->written * 100 / job->total : 100;
+  if (percent != batch->percent) {
+    batch->percent = percent;
+    write(E.wakeup[1], "s", 1);
+  }
+}
+
+void saveAppend(saveBatch *batch, char *content, size_t length) {
+  if (length == 0) return;
+
+  if (batch->count == SAVE_BATCH_SIZE)
+    saveFlush(batch);
+
+  batch->iov[batch->count++] = (struct iovec){content, length};
+}
+
+// Same layout as pieceContent, but pointing at the lines in the original
+// file instead of copying them
+void saveOriginalPiece(saveBatch *batch, linePiece *piece) {
+  char *eol = batch->job->eol;
+  int i = 0;
+
+  if (E.original.index.crlf == 0) {
+    size_t length;
+    char *content = originalLinesContent(piece->start, piece->count, &length);
+
+    if (length && content[length - 1] == LINE_FEED)
+      i = piece->count;
+    else
+      content = originalLinesContent(piece->start, i = piece->count - 1, &length);
+
+    saveAppend(batch, content, length);
+  }
+
+  for (; i < piece->count; i++) {
+    int length;
+    char *content = originalLineContent(piece->start + i, &length);
+
+    saveAppend(batch, content, length);
+    saveAppend(batch, eol, strlen(eol));
+  }
+}
+
+// Gives a file that takes the place of 'path' the same permissions; only
+// root can keep another user as its owner
+bool saveKeepMode(int fd, char *path) {
+  struct stat st;
+
+  if (stat(path, &st) == -1)
+    return fchmod(fd, 0644 & ~E.saver.umask) == 0;
+
+  if (fchown(fd, st.st_uid, st.st_gid) == -1 && errno != EPERM)
+    return false;
+  return fchmod(fd, st.st_mode & 07777) == 0;
+}
+
+// The lines are written with as few calls as possible, straight from
+// where they are kept, so saving takes no more memory however big the file
+bool saveSegments(saveJob *job, int fd) {
+  static saveBatch batch;
+  batch.fd = fd;
+  batch.count = 0;
+  batch.job = job;
+  batch.percent = 0;
+  batch.written = 0;
+  batch.isFailed = false;
+
+  for (int i = 0; i < job->numsegments; i++) {
+    saveSegment *segment = &job->segments[i];
+
+    if (segment->piece.isOriginal)
+      saveOriginalPiece(&batch, &segment->piece);
+    else
+      saveAppend(&batch, segment->text, segment->length);
+  }
+  saveFlush(&batch);
+
+  return !batch.isFailed && fsync(fd) == 0;
+}
+
+// The rename itself is only durable once the directory is synced
+void saveSyncDirectory(char *path, int dirLength) {
+  char *dir = dirLength ? strndup(path, dirLength) : strdup(".");
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+
+  if (fd != -1) {
+    fsync(fd);
+    close(fd);
+  }
+  free(dir);
+}
+
+// Writes the snapshot to a new file next to its path and moves it over
+// the old one once it is safely on disk, so a crash leaves either version
+// whole; runs on the saver thread
+void saveRun(saveJob *job) {
+  char *path = job->path;
+  const char *slash = strrchr(path, '/');
+  int dirLength = slash ? slash - path + 1 : 0;
+
+  char *temp = malloc(strlen(path) + 9);
+  sprintf(temp, "%.*s.%s.XXXXXX", dirLength, path, path + dirLength);
+
+  int fd = mkstemp(temp);
+
+  if (fd != -1) {
+    if (saveKeepMode(fd, path) && saveSegments(job, fd) && rename(temp, path) == 0) {
+      saveSyncDirectory(path, dirLength);
+    }
+    else {
+      int error = errno;
+      close(fd);
+      unlink(temp);
+      errno = error;
+      fd = -1;
+    }
+  }
+
+  job->fd = fd;
+  job->error = errno;
+  free(temp);
+}
+
+void saverFreeJob(saveJob *job) {
+  for (int i = 0; i < job->numsegments; i++)
+    free(job->segments[i].text);
+  free(job->segments);
+  free(job->path);
+  free(job);
+}
+
+void *saverThread(void *arg) {
+  (void)arg;
+
+  pthread_mutex_lock(&E.saver.lock);
+  while (true) {
+    while (E.saver.job == NULL)
+      pthread_cond_wait(&E.saver.wake, &E.saver.lock);
+
+    saveJob *job = E.saver.job;
+    E.saver.job = NULL;
+    E.saver.isBusy = true;
+    pthread_mutex_unlock(&E.saver.lock);
+
+    saveRun(job);
+
+    pthread_mutex_lock(&E.saver.lock);
+    E.saver.finished = job;
+    E.saver.isBusy = false;
+    pthread_cond_broadcast(&E.saver.idle);
+    write(E.wakeup[1], "s", 1);
+  }
+
+  return NULL;
+}
+
+void saverStart(void) {
+  E.saver.isBusy = false;
+  E.saver.job = E.saver.current = E.saver.finished = NULL;
+
+  // Reading the mask means setting it, which the saver thread cannot do
+  // while other threads may be creating files
+  E.saver.umask = umask(0);
+  umask(E.saver.umask);
+
+  pthread_mutex_init(&E.saver.lock, NULL);
+  pthread_cond_init(&E.saver.wake, NULL);
+  pthread_cond_init(&E.saver.idle, NULL);
+
+  // Without the thread the file is written before the editor goes on
+  E.saver.isRunning = pthread_create(&E.saver.thread, NULL, saverThread, NULL) == 0;
+}
+
+void saverAddPiece(linePiece *piece, void *arg) {
+  saveJob *job = arg;
+  saveSegment segment = {*piece, NULL, pieceContent(piece, NULL)};
+
+  if (!piece->isOriginal) {
+    segment.text = malloc(segment.length);
+    pieceContent(piece, segment.text);
+  }
+
+  job->segments = realloc(job->segments, sizeof(saveSegment) * (job->numsegments + 1));
+  job->segments[job->numsegments++] = segment;
+  job->total += segment.length;
+}
+
+// Takes a snapshot of the buffer to be written to 'path', which it takes
+// over
+saveJob *saverSnapshot(char *path) {
+  saveJob *job = malloc(sizeof(saveJob));
+  job->path = path;
+  job->segments = NULL;
+  job->numsegments = 0;
+  job->eol = originalIsCRLF() ? "\r\n" : "\n";
+  job->changes = E.changes;
+  job->journalMark = journalMark();
+  job->total = job->written = 0;
+  job->start = currentMilliseconds();
+
+  gapClose();
+  piecesTraverse(saverAddPiece, job);
+  return job;
+}
+
+// Hands a snapshot of the buffer to the saver thread, to be written to
+// 'path', which it takes over
+void saverPost(char *path) {
+  saveJob *job = saverSnapshot(path);
+  E.saver.current = job;
+
+  if (!E.saver.isRunning) {
+    saveRun(job);
+    E.saver.finished = job;
+    saverFinish();
+    return;
+  }
+
+  pthread_mutex_lock(&E.saver.lock);
+  E.saver.job = job;
+  pthread_cond_signal(&E.saver.wake);
+  pthread_mutex_unlock(&E.saver.lock);
+}
+
+// Waits for the thread to be done with the original file
+void saverWait(void) {
+  if (!E.saver.isRunning) return;
+
+  pthread_mutex_lock(&E.saver.lock);
+  while (E.saver.job || E.saver.isBusy)
+    pthread_cond_wait(&E.saver.idle, &E.saver.lock);
+  pthread_mutex_unlock(&E.saver.lock);
+}
+
+// Writes the buffer to 'path', which it takes over, before going on and
+// without touching the state of the buffer, returning the error it ran
+// into or 0
+int saverWrite(char *path) {
+  saverWait();
+
+  saveJob *job = saverSnapshot(path);
+  saveRun(job);
+
+  int error = job->fd == -1 ? job->error : 0;
+  if (job->fd != -1) close(job->fd);
+  saverFreeJob(job);
+  return error;
+}
+
+// Takes back a save the thread is done with, returning whether there was
+// one. The buffer only counts as saved when nothing changed since its
+// snapshot was taken. How it went is not shown over an open prompt
+bool saverFinish(void) {
+  pthread_mutex_lock(&E.saver.lock);
+  saveJob *job = E.saver.finished;
+  E.saver.finished = NULL;
+  pthread_mutex_unlock(&E.saver.lock);
+
+  if (job == NULL) return false;
+
+  E.saver.current = NULL;
+
+  if (job->fd == -1) {
+    if (!E.isPrompting)
+      editorSetStatusMessage("Can't save! I/O error: %s", strerror(job->error));
+    saverFreeJob(job);
+    return true;
+  }
+
+  if (E.changes == job->changes) {
+    // A mapped buffer still reads from the file that was replaced, so its
+    // lines are loaded again from the saved one
+    if (E.original.isMapped) {
+      undoLoadOriginal();
+      piecesFree();
+      E.numlines = 0;
+      editorLoadFile(job->fd);
+      editorLoadIndexedLines();
+    }
+
+    journalDiscard();
+    E.dirty = false;
+    E.undo.saved = E.undo.done;
+  }
+  else {
+    // Where the undo log stood when the snapshot was taken is not kept
+    journalRebase(job->journalMark);
+    E.dirty = true;
+    E.undo.saved = -1;
+  }
+  close(job->fd);
+
+  long elapsed = max(1, currentMilliseconds() - job->start);
+  if (!E.isPrompting)
+    editorSetStatusMessage("%zu bytes written to disk (%.1f MB/s)", job->written, job->written / 1000.0 / elapsed);
+
+  saverFreeJob(job);
+  return true;
+}
+
+// Tells how much of the file being saved is written so far
+bool saverProgress(int *percent) {
+  saveJob *job = E.saver.current;
+  if (job == NULL) return false;
+
+  size_t written = __atomic_load_n(&job->written, __ATOMIC_RELAXED);
+  *percent = job->total ? written * 100 / job->total : 100;
+  return true;
+}
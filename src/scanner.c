@@ -0,0 +1,151 @@
+#include <scanner.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define SCANNER_X86
+  #include <immintrin.h>
+#endif
+
+void lineIndexPush(lineIndex *index, size_t offset) {
+  if (index->numlines == index->capacity) {
+    index->capacity = index->capacity ? 2 * index->capacity : 1024;
+    index->offsets = realloc(index->offsets, sizeof(uint32_t) * index->capacity);
+    index->tabs = realloc(index->tabs, index->capacity);
+  }
+
+  // The first line past every 4 GiB boundary is recorded, so the high bits
+  // of an offset are the number of boundaries recorded up to its line
+  while ((uint64_t)index->numwraps < ((uint64_t)offset >> 32)) {
+    index->wraps = realloc(index->wraps, sizeof(int) * (index->numwraps + 1));
+    index->wraps[index->numwraps++] = index->numlines;
+  }
+
+  index->offsets[index->numlines] = (uint32_t)offset;
+  index->tabs[index->numlines] = 0;
+  index->numlines++;
+}
+
+size_t lineIndexOffset(lineIndex *index, int line) {
+  uint64_t high = 0;
+  while ((int)high < index->numwraps && index->wraps[high] <= line)
+    high++;
+
+  return (size_t)(high << 32 | index->offsets[line]);
+}
+
+void lineIndexAppend(lineIndex *dest, lineIndex *src) {
+  int first = dest->numlines;
+  int numlines = first + src->numlines;
+
+  if (numlines > dest->capacity) {
+    dest->capacity = numlines;
+    dest->offsets = realloc(dest->offsets, sizeof(uint32_t) * numlines);
+    dest->tabs = realloc(dest->tabs, numlines);
+  }
+  memcpy(&dest->offsets[first], src->offsets, sizeof(uint32_t) * src->numlines);
+  memcpy(&dest->tabs[first], src->tabs, src->numlines);
+
+  // Boundaries already crossed before the appended lines are not repeated
+  if (src->numwraps > dest->numwraps) {
+    dest->wraps = realloc(dest->wraps, sizeof(int) * src->numwraps);
+    for (int i = dest->numwraps; i < src->numwraps; i++)
+      dest->wraps[i] = first + src->wraps[i];
+    dest->numwraps = src->numwraps;
+  }
+
+  dest->numlines = numlines;
+  dest->crlf += src->crlf;
+}
+
+void lineIndexFree(lineIndex *index) {
+  free(index->offsets);
+  free(index->tabs);
+  free(index->wraps);
+  memset(index, 0, sizeof(lineIndex));
+}
+
+void scanAddTabs(lineIndex *index, int count) {
+  unsigned char *tabs = &index->tabs[index->numlines - 1];
+  *tabs = *tabs + count > MAX_LINE_TABS ? MAX_LINE_TABS : *tabs + count;
+}
+
+void scanNewline(lineIndex *index, const char *content, size_t at, size_t end) {
+  if (at > 0 && content[at - 1] == RETURN)
+    index->crlf++;
+
+  if (at + 1 < end)
+    lineIndexPush(index, at + 1);
+}
+
+size_t scanScalar(lineIndex *index, const char *content, size_t pos, size_t to, size_t end) {
+  for (; pos < to; pos++) {
+    if (content[pos] == LINE_FEED)
+      scanNewline(index, content, pos, end);
+    else if (content[pos] == TAB)
+      scanAddTabs(index, 1);
+  }
+  return pos;
+}
+
+#ifdef SCANNER_X86
+// Handles the newline and tab bit masks of one vector of bytes at 'base'
+void scanBlock(lineIndex *index, const char *content, size_t base, unsigned int newlines, unsigned int tabs, size_t end) {
+  while (newlines) {
+    int bit = __builtin_ctz(newlines);
+    unsigned int before = tabs & ((1u << bit) - 1);
+
+    scanAddTabs(index, __builtin_popcount(before));
+    tabs &= ~before;
+
+    scanNewline(index, content, base + bit, end);
+    newlines &= newlines - 1;
+  }
+  scanAddTabs(index, __builtin_popcount(tabs));
+}
+
+__attribute__((target("sse2")))
+size_t scanSSE2(lineIndex *index, const char *content, size_t pos, size_t to, size_t end) {
+  const __m128i newline = _mm_set1_epi8(LINE_FEED);
+  const __m128i tab = _mm_set1_epi8(TAB);
+
+  for (; pos + 16 <= to; pos += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(content + pos));
+    unsigned int newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+    unsigned int tabs = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, tab));
+
+    if (newlines | tabs)
+      scanBlock(index, content, pos, newlines, tabs, end);
+  }
+  return pos;
+}
+
+__attribute__((target("avx2")))
+size_t scanAVX2(lineIndex *index, const char *content, size_t pos, size_t to, size_t end) {
+  const __m256i newline = _mm256_set1_epi8(LINE_FEED);
+  const __m256i tab = _mm256_set1_epi8(TAB);
+
+  for (; pos + 32 <= to; pos += 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)(content + pos));
+    unsigned int newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+    unsigned int tabs = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, tab));
+
+    if (newlines | tabs)
+      scanBlock(index, content, pos, newlines, tabs, end);
+  }
+  return pos;
+}
+#endif
+
+// Records the start of every line that follows a newline in content[from, to)
+// and counts the tabs of each one; lines starting at 'end' are left out
+void scanLines(lineIndex *index, const char *content, size_t from, size_t to, size_t end) {
+  size_t pos = from;
+
+#ifdef SCANNER_X86
+  if (__builtin_cpu_supports("avx2"))
+    pos = scanAVX2(index, content, pos, to, end);
+  else if (__builtin_cpu_supports("sse2"))
+    pos = scanSSE2(index, content, pos, to, end);
+#endif
+
+  scanScalar(index, content, pos, to, end);
+}
@@ -0,0 +1,229 @@
+#include <buffer.h>
+#include <output.h>
+#include <screen.h>
+#include <terminal.h>
+#include <tools.h>
+
+// Starts drawing a frame, resizing the cell buffers along with the terminal
+void screenBegin(void) {
+  int rows = E.screenRows + 1;
+  int cols = E.screenCols;
+
+  if (rows != E.screen.rows || cols != E.screen.cols) {
+    E.screen.front = realloc(E.screen.front, sizeof(screenCell) * rows * cols);
+    E.screen.back = realloc(E.screen.back, sizeof(screenCell) * rows * cols);
+    E.screen.rows = rows;
+    E.screen.cols = cols;
+    E.screen.isValid = false;
+  }
+
+  E.screen.row = E.screen.col = 0;
+  E.screen.fg = theme.text.standard;
+  E.screen.bg = theme.background;
+  E.screen.isBold = false;
+
+  for (int i = 0; i < rows * cols; i++)
+    E.screen.back[i] = (screenCell){SPACE, false, E.screen.fg, E.screen.bg};
+}
+
+void screenWrite(const char *text, int length) {
+  if (E.screen.row >= E.screen.rows) return;
+
+  screenCell *cells = &E.screen.back[E.screen.row * E.screen.cols];
+
+  for (int i = 0; i < length && E.screen.col < E.screen.cols; i++)
+    cells[E.screen.col++] = (screenCell){text[i], E.screen.isBold, E.screen.fg, E.screen.bg};
+}
+
+void screenSetColor(color_t color) {
+  if (color.isBackground)
+    E.screen.bg = color;
+  else
+    E.screen.fg = color;
+}
+
+void screenSetBold(bool isBold) {
+  E.screen.isBold = isBold;
+}
+
+// Clears the rest of the row with the current colors
+void screenEraseLine(void) {
+  if (E.screen.row >= E.screen.rows) return;
+
+  screenCell *cells = &E.screen.back[E.screen.row * E.screen.cols];
+
+  for (int col = E.screen.col; col < E.screen.cols; col++)
+    cells[col] = (screenCell){SPACE, false, E.screen.fg, E.screen.bg};
+}
+
+void screenNewline(void) {
+  E.screen.row++;
+  E.screen.col = 0;
+}
+
+// Only the background of a blank cell can be seen
+bool screenCellEqual(screenCell *a, screenCell *b) {
+  if (a->ch != b->ch || !colorcmp(a->bg, b->bg))
+    return false;
+  return a->ch == SPACE || (a->isBold == b->isBold && colorcmp(a->fg, b->fg));
+}
+
+// Rows holding anything but printable ASCII are always drawn whole, as the
+// terminal may not give each of their bytes a column of its own
+bool screenRowIsPlain(screenCell *cells) {
+  for (int col = 0; col < E.screen.cols; col++) {
+    unsigned char c = cells[col].ch;
+    if (c < SPACE || c >= 127)
+      return false;
+  }
+  return true;
+}
+
+void screenMoveTo(buffer *buff, int row, int col) {
+  char move[32];
+  int len = snprintf(move, sizeof(move), "\x1b[%d;%dH", row + 1, col + 1);
+  appendBuffer(buff, move, len);
+}
+
+void screenSetPenBackground(buffer *buff, color_t bg) {
+  if (E.screen.pen.hasBg && colorcmp(bg, E.screen.pen.bg)) return;
+
+  editorHighlightOutput(buff, bg);
+  E.screen.pen.bg = bg;
+  E.screen.pen.hasBg = true;
+}
+
+bool screenPenFits(screenCell *cell) {
+  if (!colorcmp(cell->bg, E.screen.pen.bg)) return false;
+  if (cell->ch == SPACE) return true;
+  return E.screen.pen.hasFg && cell->isBold == E.screen.pen.isBold && colorcmp(cell->fg, E.screen.pen.fg);
+}
+
+// Emits count cells, switching the pen only where their look changes and
+// copying each run drawn with the same pen in one go
+void screenEmitCells(buffer *buff, screenCell *cells, int count) {
+  int i = 0;
+  while (i < count) {
+    screenCell *cell = &cells[i];
+
+    if (cell->ch != SPACE) {
+      if (cell->isBold != E.screen.pen.isBold) {
+        appendBuffer(buff, cell->isBold ? "\x1b[1m" : "\x1b[22m", cell->isBold ? 4 : 5);
+        E.screen.pen.isBold = cell->isBold;
+      }
+
+      if (!E.screen.pen.hasFg || !colorcmp(cell->fg, E.screen.pen.fg)) {
+        editorHighlightOutput(buff, cell->fg);
+        E.screen.pen.fg = cell->fg;
+        E.screen.pen.hasFg = true;
+      }
+    }
+
+    screenSetPenBackground(buff, cell->bg);
+
+    int run = i + 1;
+    while (run < count && screenPenFits(&cells[run]))
+      run++;
+
+    char *out = extendBuffer(buff, run - i);
+    for (; i < run; i++)
+      *out++ = cells[i].ch;
+  }
+}
+
+// Sends the terminal what changed since the last frame: every row that
+// differs is redrawn from its first to its last changed cell, skipping
+// runs of at least SCREEN_SPAN_GAP unchanged cells with a cursor move
+void screenFlush(int cursorRow, int cursorCol) {
+  buffer *buff = &E.screen.output;
+  int rows = E.screen.rows;
+  int cols = E.screen.cols;
+  int atRow = -1, atCol = -1;
+
+  // The frame is built in a buffer kept from the last one, so it only
+  // grows when a frame is bigger than any before
+  buff->length = 0;
+
+  for (int row = 0; row < rows; row++) {
+    screenCell *back = &E.screen.back[row * cols];
+    screenCell *front = &E.screen.front[row * cols];
+
+    bool isWhole = !E.screen.isValid || !screenRowIsPlain(back) || !screenRowIsPlain(front);
+    int first = 0, last = cols - 1;
+
+    if (!isWhole) {
+      while (first < cols && screenCellEqual(&back[first], &front[first]))
+        first++;
+      if (first == cols) continue;
+
+      while (screenCellEqual(&back[last], &front[last]))
+        last--;
+    }
+
+    if (buff->length == 0)
+      appendBuffer(buff, "\x1b[?25l", 6); // Make cursor invisible
+
+    // A changed blank end of the row is cleared in one go
+    int tail = cols;
+    while (tail > first && back[tail - 1].ch == SPACE && colorcmp(back[tail - 1].bg, back[cols - 1].bg))
+      tail--;
+
+    bool isErased = last >= tail && cols - tail >= SCREEN_SPAN_GAP;
+    int end = isErased ? tail : last + 1;
+
+    int col = first;
+    while (col < end) {
+      int spanEnd = col + 1;
+
+      for (int same = 0, c = spanEnd; c < end && same < SCREEN_SPAN_GAP; c++) {
+        if (!isWhole && screenCellEqual(&back[c], &front[c])) {
+          same++;
+        }
+        else {
+          same = 0;
+          spanEnd = c + 1;
+        }
+      }
+
+      if (atRow != row || atCol != col)
+        screenMoveTo(buff, row, col);
+
+      screenEmitCells(buff, &back[col], spanEnd - col);
+      col = spanEnd;
+
+      atRow = row;
+      atCol = col < cols ? col : -1;
+
+      while (col < end && screenCellEqual(&back[col], &front[col]))
+        col++;
+    }
+
+    if (isErased) {
+      if (atRow != row || atCol != tail)
+        screenMoveTo(buff, row, tail);
+
+      screenSetPenBackground(buff, back[cols - 1].bg);
+      appendBuffer(buff, "\x1b[K", 3); // Erase from cursor to end of line
+      atRow = row;
+      atCol = tail;
+    }
+  }
+
+  if (buff->length) {
+    appendBuffer(buff, "\x1b[0m", 4); // Reset style and colors
+    E.screen.pen.hasFg = E.screen.pen.hasBg = false;
+    E.screen.pen.isBold = false;
+  }
+
+  bool isHidden = buff->length > 0;
+  screenMoveTo(buff, cursorRow, cursorCol);
+  if (isHidden)
+    appendBuffer(buff, "\x1b[?25h", 6); // Make cursor visible
+
+  terminalWrite(buff->content, buff->length);
+
+  screenCell *front = E.screen.front;
+  E.screen.front = E.screen.back;
+  E.screen.back = front;
+  E.screen.isValid = true;
+}
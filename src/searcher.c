@@ -0,0 +1,316 @@
+#define _DEFAULT_SOURCE
+
+#include <finder.h>
+#include <gap.h>
+#include <lines.h>
+#include <pieces.h>
+#include <regexp.h>
+#include <scanner.h>
+#include <searcher.h>
+#include <tools.h>
+
+// Counting the matches of a query takes a search of the whole buffer, cut
+// into chunks of lines that worker threads take on in turn. Every chunk
+// keeps its own matches, so putting them in order only means going through
+// the chunks once all of them are done. A search that is no longer wanted
+// is dropped, and its workers give up at the next window or line they get to
+
+void searcherFreeJob(searchJob *job) {
+  for (int i = 0; i < job->numchunks; i++) {
+    free(job->chunks[i].text);
+    free(job->chunks[i].matches);
+  }
+  free(job->chunks);
+  free(job->source);
+  free(job);
+}
+
+bool searcherIsCancelled(searchJob *job) {
+  return __atomic_load_n(&E.searcher.generation, __ATOMIC_ACQUIRE) != job->generation;
+}
+
+void searcherAdd(searchChunk *chunk, int row, int col, int length) {
+  chunk->total++;
+  if (!chunk->isKeeping) return;
+
+  // Past the limit matches are only counted
+  if (chunk->kept + chunk->nummatches == FIND_INDEX_LIMIT) {
+    chunk->isKeeping = false;
+    return;
+  }
+
+  if (chunk->nummatches == chunk->capacity) {
+    chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 64;
+    chunk->matches = realloc(chunk->matches, chunk->capacity * sizeof(findMatch));
+  }
+  chunk->matches[chunk->nummatches++] = (findMatch){row, col, length};
+}
+
+// The lines are searched a window of them at a time, so a search that is
+// no longer wanted is given up soon even where nothing matches. Windows
+// end on a line feed, and a match never goes past one, so no match is cut
+// in two; a single line longer than a window makes a window of its own
+void searcherScanOriginal(searchJob *job, findQuery *query, searchChunk *chunk) {
+  int first = chunk->piece.start;
+  int end = first + chunk->piece.count;
+  int line = first;
+
+  size_t length;
+  char *content = originalLinesContent(first, chunk->piece.count, &length);
+  char *at = content;
+  char *match;
+  int matchLength;
+
+  do {
+    if (searcherIsCancelled(job)) return;
+
+    char *stop = content + length;
+    if (stop - at > SEARCH_WINDOW_BYTES) {
+      char *feed = memchr(at + SEARCH_WINDOW_BYTES - 1, LINE_FEED, stop - at - SEARCH_WINDOW_BYTES + 1);
+      if (feed) stop = feed + 1;
+    }
+
+    // Past the line feed that ends the window is where the next one starts
+    char *last = stop > content && stop[-1] == LINE_FEED ? stop - 1 : stop;
+
+    while (at <= last && (match = findNextIn(query, at, stop - at, at == content || at[-1] == LINE_FEED, &matchLength))) {
+      if (match > last) break;
+      at = match + 1;
+
+      // The line feed of a carriage return is no column of its line
+      if (*match == LINE_FEED && match > content && match[-1] == RETURN)
+        continue;
+
+      size_t offset = match - E.original.content;
+      line = findOriginalLineFrom(line, end, offset);
+
+      searcherAdd(chunk, chunk->row + line - first, offset - lineIndexOffset(&E.original.index, line), matchLength);
+    }
+    at = stop;
+  } while (at < content + length);
+}
+
+void searcherScanAdded(searchJob *job, findQuery *query, searchChunk *chunk) {
+  char *content = chunk->text;
+
+  for (int i = 0; i < chunk->piece.count; i++) {
+    if (searcherIsCancelled(job)) return;
+
+    int length = (char *)memchr(content, LINE_FEED, chunk->text + chunk->length - content) - content;
+    int at = 0, matchLength;
+    char *match;
+
+    while (at <= length && (match = findNextIn(query, content + at, length - at, at == 0, &matchLength))) {
+      int col = match - content;
+      searcherAdd(chunk, chunk->row + i, col, matchLength);
+      at = col + 1;
+    }
+    content += length + 1;
+  }
+}
+
+void searcherRun(searchJob *job, findQuery *query, searchChunk *chunk) {
+  if (chunk->piece.isOriginal)
+    searcherScanOriginal(job, query, chunk);
+  else
+    searcherScanAdded(job, query, chunk);
+}
+
+void *searcherThread(void *arg) {
+  (void)arg;
+
+  findQuery query;
+  memset(&query, 0, sizeof(findQuery));
+  unsigned int generation = 0;
+
+  pthread_mutex_lock(&E.searcher.lock);
+  while (true) {
+    searchJob *job = E.searcher.job;
+
+    if (job == NULL || job->next == job->numchunks) {
+      pthread_cond_wait(&E.searcher.wake, &E.searcher.lock);
+      continue;
+    }
+
+    searchChunk *chunk = &job->chunks[job->next++];
+    chunk->kept = job->kept;
+    E.searcher.busy++;
+    pthread_mutex_unlock(&E.searcher.lock);
+
+    // Every worker compiles the query for itself, since a regular
+    // expression builds its matcher while it runs
+    if (generation != job->generation) {
+      regexpFree(&query.regex);
+      query.source = job->source;
+      query.isRegex = job->isRegex;
+      findQueryCompile(&query);
+      generation = job->generation;
+    }
+
+    searcherRun(job, &query, chunk);
+
+    pthread_mutex_lock(&E.searcher.lock);
+    E.searcher.busy--;
+    job->kept += chunk->nummatches;
+
+    if (++job->done == job->numchunks && !searcherIsCancelled(job))
+      write(E.wakeup[1], "f", 1);
+    pthread_cond_broadcast(&E.searcher.idle);
+  }
+
+  return NULL;
+}
+
+void searcherStart(void) {
+  E.searcher.busy = 0;
+  E.searcher.job = NULL;
+  E.searcher.generation = 0;
+
+  pthread_mutex_init(&E.searcher.lock, NULL);
+  pthread_cond_init(&E.searcher.wake, NULL);
+  pthread_cond_init(&E.searcher.idle, NULL);
+
+  int count = clamp(1, sysconf(_SC_NPROCESSORS_ONLN), SEARCH_MAX_THREADS);
+  E.searcher.numthreads = 0;
+
+  for (int i = 0; i < count; i++) {
+    if (pthread_create(&E.searcher.threads[E.searcher.numthreads], NULL, searcherThread, NULL) == 0)
+      E.searcher.numthreads++;
+  }
+
+  // Without the threads the buffer is searched before the editor goes on
+  E.searcher.isRunning = E.searcher.numthreads > 0;
+}
+
+// Lines of the original file are searched where they lie in the mapping,
+// which stays in place until the workers are done; the others are copied
+void searcherAddPiece(linePiece *piece, void *arg) {
+  searchJob *job = arg;
+  searchChunk *last = job->numchunks ? &job->chunks[job->numchunks - 1] : NULL;
+  int row = last ? last->row + last->piece.count : 0;
+
+  for (int i = 0; i < piece->count; i += SEARCH_CHUNK_LINES) {
+    searchChunk chunk;
+    memset(&chunk, 0, sizeof(searchChunk));
+    chunk.row = row + i;
+    chunk.piece = *piece;
+    chunk.piece.start += i;
+    chunk.piece.count = min(SEARCH_CHUNK_LINES, piece->count - i);
+    chunk.isKeeping = true;
+
+    if (!piece->isOriginal) {
+      for (int j = 0; j < chunk.piece.count; j++)
+        chunk.length += addedLine(chunk.piece.start + j)->length + 1;
+
+      chunk.text = malloc(chunk.length);
+      char *at = chunk.text;
+
+      for (int j = 0; j < chunk.piece.count; j++) {
+        editorLine *line = addedLine(chunk.piece.start + j);
+        memcpy(at, line->content, line->length);
+        at[line->length] = LINE_FEED;
+        at += line->length + 1;
+      }
+    }
+
+    job->chunks = realloc(job->chunks, sizeof(searchChunk) * (job->numchunks + 1));
+    job->chunks[job->numchunks++] = chunk;
+  }
+}
+
+// Starts counting the matches of a compiled query over the whole buffer,
+// dropping the search going on
+void searcherPost(findQuery *query) {
+  searcherCancel();
+  editorLoadIndexedLines();
+  gapClose();
+
+  searchJob *job = malloc(sizeof(searchJob));
+  job->generation = E.searcher.generation;
+  job->source = strdup(query->source);
+  job->isRegex = query->isRegex;
+  job->chunks = NULL;
+  job->numchunks = 0;
+  job->next = job->done = job->kept = 0;
+
+  piecesTraverse(searcherAddPiece, job);
+
+  if (!E.searcher.isRunning || job->numchunks == 0) {
+    for (; job->next < job->numchunks; job->next++, job->done++) {
+      searchChunk *chunk = &job->chunks[job->next];
+      chunk->kept = job->kept;
+      searcherRun(job, query, chunk);
+      job->kept += chunk->nummatches;
+    }
+
+    E.searcher.job = job;
+    searcherFinish();
+    return;
+  }
+
+  pthread_mutex_lock(&E.searcher.lock);
+  E.searcher.job = job;
+  pthread_cond_broadcast(&E.searcher.wake);
+  pthread_mutex_unlock(&E.searcher.lock);
+}
+
+// Drops the search going on, and waits for the workers to let go of it
+void searcherCancel(void) {
+  __atomic_add_fetch(&E.searcher.generation, 1, __ATOMIC_RELEASE);
+
+  searchJob *job = E.searcher.job;
+  if (job == NULL) return;
+
+  pthread_mutex_lock(&E.searcher.lock);
+  E.searcher.job = NULL;
+
+  while (E.searcher.busy > 0)
+    pthread_cond_wait(&E.searcher.idle, &E.searcher.lock);
+  pthread_mutex_unlock(&E.searcher.lock);
+
+  searcherFreeJob(job);
+}
+
+// Takes the matches of a search the workers are done with into the index,
+// returning whether there was one. They are all listed there only when
+// every chunk kept all of its own and there are not too many in all
+bool searcherFinish(void) {
+  pthread_mutex_lock(&E.searcher.lock);
+  searchJob *job = E.searcher.job;
+  bool isDone = job && job->done == job->numchunks;
+  if (isDone) E.searcher.job = NULL;
+  pthread_mutex_unlock(&E.searcher.lock);
+
+  if (!isDone) return false;
+
+  int total = 0;
+  bool isComplete = true;
+
+  for (int i = 0; i < job->numchunks; i++) {
+    total += job->chunks[i].total;
+    isComplete = isComplete && job->chunks[i].isKeeping;
+  }
+
+  E.matches.count = 0;
+  E.matches.isComplete = isComplete && total <= FIND_INDEX_LIMIT;
+  E.matches.total = total;
+  E.matches.isCounted = true;
+
+  if (E.matches.isComplete) {
+    if (total > E.matches.capacity) {
+      E.matches.capacity = total;
+      E.matches.matches = realloc(E.matches.matches, total * sizeof(findMatch));
+    }
+
+    for (int i = 0; i < job->numchunks; i++) {
+      searchChunk *chunk = &job->chunks[i];
+      if (chunk->nummatches == 0) continue;
+
+      memcpy(&E.matches.matches[E.matches.count], chunk->matches, chunk->nummatches * sizeof(findMatch));
+      E.matches.count += chunk->nummatches;
+    }
+  }
+
+  searcherFreeJob(job);
+  return true;
+}
@@ -0,0 +1,218 @@
+#include <output.h>
+#include <slab.h>
+
+// Line buffers come from blocks of SLAB_CLASSES sizes, going up from
+// SLAB_MIN_BLOCK bytes in steps of one and a half and then twice the size
+// before, carved out of SLAB_CHUNK_SIZE chunks; anything bigger is
+// allocated on its own. Every block starts with a header telling its class
+// and how much of it is in use. The editor thread takes and gives back
+// blocks through a cache of its own without locking, and only locks to add
+// a chunk or for a large buffer. The highlighter thread goes through the
+// shared cache under the lock. A block freed on a different thread than
+// the one it came from joins the cache of the thread freeing it, which is
+// safe as chunks are only given back all at once
+
+// Set on the thread that sets the slab up
+static __thread bool isOwner;
+
+void slabInit(void) {
+  pthread_mutex_init(&E.slab.lock, NULL);
+  isOwner = true;
+  memset(&E.slab.own, 0, sizeof(slabCache));
+  memset(&E.slab.shared, 0, sizeof(slabCache));
+  E.slab.chunks = NULL;
+  E.slab.numchunks = 0;
+  E.slab.large = NULL;
+  E.slab.largeBytes = 0;
+}
+
+size_t slabBlockSize(int sizeClass) {
+  size_t base = (size_t)SLAB_MIN_BLOCK << (sizeClass / 2);
+  return sizeClass % 2 ? base + base / 2 : base;
+}
+
+int slabClassOf(size_t size) {
+  int sizeClass = 0;
+  while (sizeClass < SLAB_CLASSES && slabBlockSize(sizeClass) < size + sizeof(slabHeader))
+    sizeClass++;
+  return sizeClass;
+}
+
+// Large buffers keep their size out of the header, as it may not fit there
+size_t slabSizeOf(slabHeader *header) {
+  if (header->sizeClass >= SLAB_CLASSES)
+    return ((slabLarge *)header - 1)->size;
+  return header->size;
+}
+
+// Takes a chunk for blocks of 'slab', with the lock held unless the cache is
+// the editor thread's own
+void slabGrow(slabCache *cache, slabClass *slab) {
+  if (cache == &E.slab.own)
+    pthread_mutex_lock(&E.slab.lock);
+
+  E.slab.chunks = realloc(E.slab.chunks, sizeof(char *) * (E.slab.numchunks + 1));
+  E.slab.chunks[E.slab.numchunks++] = slab->next = malloc(SLAB_CHUNK_SIZE);
+  slab->end = slab->next + SLAB_CHUNK_SIZE;
+
+  if (cache == &E.slab.own)
+    pthread_mutex_unlock(&E.slab.lock);
+}
+
+// Large buffers are only taken from the shared cache
+void *slabTake(slabCache *cache, size_t size) {
+  int sizeClass = slabClassOf(size);
+  slabHeader *header;
+
+  if (sizeClass >= SLAB_CLASSES) {
+    slabLarge *large = malloc(sizeof(slabLarge) + sizeof(slabHeader) + size);
+    large->size = size;
+    large->prev = NULL;
+    large->next = E.slab.large;
+    if (E.slab.large)
+      E.slab.large->prev = large;
+    E.slab.large = large;
+    E.slab.largeBytes += size;
+
+    header = (slabHeader *)(large + 1);
+  }
+  else {
+    size_t blockSize = slabBlockSize(sizeClass);
+    slabClass *slab = &cache->classes[sizeClass];
+
+    if (slab->freed) {
+      header = slab->freed;
+      slab->freed = *(void **)slab->freed;
+    }
+    else {
+      if (slab->next == NULL || (size_t)(slab->end - slab->next) < blockSize)
+        slabGrow(cache, slab);
+      header = (slabHeader *)slab->next;
+      slab->next += blockSize;
+    }
+    cache->usedBytes += blockSize;
+  }
+
+  header->size = sizeClass < SLAB_CLASSES ? size : 0;
+  header->sizeClass = sizeClass;
+  cache->liveBytes += size;
+  return header + 1;
+}
+
+void slabGive(slabCache *cache, void *block) {
+  slabHeader *header = (slabHeader *)block - 1;
+  cache->liveBytes -= slabSizeOf(header);
+
+  if (header->sizeClass >= SLAB_CLASSES) {
+    slabLarge *large = (slabLarge *)header - 1;
+    if (large->prev)
+      large->prev->next = large->next;
+    else
+      E.slab.large = large->next;
+    if (large->next)
+      large->next->prev = large->prev;
+
+    E.slab.largeBytes -= large->size;
+    free(large);
+    return;
+  }
+
+  // Free blocks are linked through their headers
+  cache->usedBytes -= slabBlockSize(header->sizeClass);
+  slabClass *slab = &cache->classes[header->sizeClass];
+  *(void **)header = slab->freed;
+  slab->freed = header;
+}
+
+void *slabAlloc(size_t size) {
+  if (isOwner && size + sizeof(slabHeader) <= slabBlockSize(SLAB_CLASSES - 1))
+    return slabTake(&E.slab.own, size);
+
+  pthread_mutex_lock(&E.slab.lock);
+  void *block = slabTake(&E.slab.shared, size);
+  pthread_mutex_unlock(&E.slab.lock);
+  return block;
+}
+
+void slabFree(void *block) {
+  if (block == NULL) return;
+
+  slabHeader *header = (slabHeader *)block - 1;
+  if (isOwner && header->sizeClass < SLAB_CLASSES) {
+    slabGive(&E.slab.own, block);
+    return;
+  }
+
+  pthread_mutex_lock(&E.slab.lock);
+  slabGive(&E.slab.shared, block);
+  pthread_mutex_unlock(&E.slab.lock);
+}
+
+// Blocks are resized in place as long as their class stays the same
+void *slabRealloc(void *block, size_t size) {
+  if (block == NULL)
+    return slabAlloc(size);
+
+  slabHeader *header = (slabHeader *)block - 1;
+
+  if (header->sizeClass < SLAB_CLASSES && (uint32_t)slabClassOf(size) == header->sizeClass) {
+    if (isOwner) {
+      E.slab.own.liveBytes += size - header->size;
+    }
+    else {
+      pthread_mutex_lock(&E.slab.lock);
+      E.slab.shared.liveBytes += size - header->size;
+      pthread_mutex_unlock(&E.slab.lock);
+    }
+    header->size = size;
+    return block;
+  }
+
+  size_t length = slabSizeOf(header);
+  void *moved = slabAlloc(size);
+  memcpy(moved, block, length < size ? length : size);
+  slabFree(block);
+  return moved;
+}
+
+// Gives back the memory of every line at once, once none of them is used
+void slabRelease(void) {
+  pthread_mutex_lock(&E.slab.lock);
+
+  for (int i = 0; i < E.slab.numchunks; i++)
+    free(E.slab.chunks[i]);
+  free(E.slab.chunks);
+
+  while (E.slab.large) {
+    slabLarge *next = E.slab.large->next;
+    free(E.slab.large);
+    E.slab.large = next;
+  }
+
+  memset(&E.slab.own, 0, sizeof(slabCache));
+  memset(&E.slab.shared, 0, sizeof(slabCache));
+  E.slab.chunks = NULL;
+  E.slab.numchunks = 0;
+  E.slab.largeBytes = 0;
+
+  pthread_mutex_unlock(&E.slab.lock);
+}
+
+void slabShowStats(void) {
+  // A block freed by the other thread counts against the cache it joins,
+  // so only the sums of both mean anything
+  pthread_mutex_lock(&E.slab.lock);
+  size_t live = E.slab.own.liveBytes + E.slab.shared.liveBytes;
+  size_t used = E.slab.own.usedBytes + E.slab.shared.usedBytes;
+  size_t held = (size_t)E.slab.numchunks * SLAB_CHUNK_SIZE + E.slab.largeBytes;
+  size_t rounding = used + E.slab.largeBytes - live;
+  size_t idle = (size_t)E.slab.numchunks * SLAB_CHUNK_SIZE - used;
+  pthread_mutex_unlock(&E.slab.lock);
+
+  // Whatever is held but not live is either the rest of partly used blocks
+  // or blocks nobody uses
+  editorSetStatusMessage(
+    "Lines: %zu KB live of %zu KB, %zu KB rounding, %zu KB free (%d%% fragmented)",
+    live / 1024, held / 1024, rounding / 1024, idle / 1024, held ? (int)(100 - 100 * live / held) : 0
+  );
+}
@@ -1,3 +1,11 @@
+#define _DEFAULT_SOURCE
+
+#include <batch.h>
+#include <buffer.h>
+#include <lines.h>
+#include <output.h>
+#include <saver.h>
+#include <searcher.h>
 #include <terminal.h>
 
 void enableRawMode(void) {
@@ -17,38 +25,166 @@ void enableRawMode(void) {
 
   if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
     die("tcsetattr");
+
+  write(STDOUT_FILENO, "\x1b[?2004h", 8); // Enable bracketed paste
 }
 
 void disableRawMode(void) {
+  write(STDOUT_FILENO, "\x1b[?2004l", 8); // Disable bracketed paste
+
   if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.original_state) == -1) 
     die("tcsetattr");
 }
 
 void die(const char *str) {
-  write(STDOUT_FILENO, "\x1b[2J", 4); // Erase entire screen
-  write(STDOUT_FILENO, "\x1b[H", 3);  // Moves cursor to home position (0, 0)
+  terminalWrite("\x1b[2J", 4); // Erase entire screen
+  terminalWrite("\x1b[H", 3);  // Moves cursor to home position (0, 0)
 
   perror(str);
   exit(1);
 }
 
-int editorReadKey(void) {
+// Sends output to the terminal, which a batch run only keeps count of
+void terminalWrite(const char *content, size_t length) {
+  if (E.batch.isRunning) {
+    E.batch.written += length;
+    return;
+  }
+  write(STDOUT_FILENO, content, length);
+}
+
+// Blocks until the terminal sends something, for at most timeout
+// milliseconds (forever when negative), and reads all of it at once.
+// Whatever wakes the editor while it waits forever is handled meanwhile
+bool editorWaitForInput(int timeout) {
+  struct pollfd fds[2] = {
+    {E.input.fd, POLLIN, 0},
+    {E.wakeup[0], POLLIN, 0}
+  };
+
+  while (true) {
+    int ready = poll(fds, timeout < 0 ? 2 : 1, timeout);
+
+    if (ready == -1) {
+      if (errno == EINTR) continue;
+      die("poll");
+    }
+    if (ready == 0)
+      return false;
+
+    if (fds[1].revents & POLLIN)
+      editorHandleEvents();
+
+    if (fds[0].revents) {
+      int n = read(E.input.fd, E.input.bytes, sizeof(E.input.bytes));
+
+      if (n == -1 && errno != EAGAIN && errno != EINTR)
+        die("read");
+
+      // The script of a batch run is over, which only ends a key that is
+      // not waited on
+      if (n == 0 && E.batch.isRunning) {
+        if (timeout >= 0) return false;
+        batchFinish();
+      }
+
+      // The terminal hung up
+      if (n == 0 && fds[0].revents & (POLLHUP | POLLERR))
+        exit(0);
+
+      if (n > 0) {
+        E.input.start = 0;
+        E.input.end = n;
+        return true;
+      }
+    }
+  }
+}
+
+// Events from the wakeup pipe: 'i' when the indexer found more lines, 'h'
+// when highlighted lines are ready, 's' when a save made progress or is
+// done, 'f' when a search is done and 'r' when the window was resized
+void editorHandleEvents(void) {
+  char events[64];
+  bool isRepaint = false;
   int n;
-  char c;
-  while ((n = read(STDIN_FILENO, &c, 1)) != 1) {
-    if (n == -1 && errno != EAGAIN)
-      die("read");
+
+  while ((n = read(E.wakeup[0], events, sizeof(events))) > 0) {
+    for (int i = 0; i < n; i++) {
+      if (events[i] == 'i') {
+        editorLoadIndexedLines();
+      }
+      else if (events[i] == 'h') {
+        isRepaint = true;
+      }
+      else if (events[i] == 'f') {
+        if (searcherFinish())
+          isRepaint = true;
+      }
+      else if (events[i] == 's') {
+        // A save that is done tells how it went in place of the status bar
+        if (saverFinish() && !E.isPrompting)
+          E.isMessageShown = true;
+        isRepaint = true;
+      }
+      else if (events[i] == 'r') {
+        editorUpdateWindowSize();
+        isRepaint = true;
+      }
+    }
   }
 
+  if (isRepaint)
+    editorRepaintScreen();
+}
+
+bool editorNextByte(char *c, int timeout) {
+  if (E.input.start == E.input.end && !editorWaitForInput(timeout))
+    return false;
+
+  *c = E.input.bytes[E.input.start++];
+  return true;
+}
+
+// Whether a key is waiting to be read, without waiting for one
+bool editorInputPending(void) {
+  if (E.input.start < E.input.end)
+    return true;
+
+  struct pollfd fd = {E.input.fd, POLLIN, 0};
+  return poll(&fd, 1, 0) > 0;
+}
+
+int editorReadKey(void) {
+  char c;
+  while (!editorNextByte(&c, -1));
+
   if (c == ESC) {
     char sequence[3];
 
-    if (read(STDIN_FILENO, &sequence[0], 1) != 1) return c;
-    if (read(STDIN_FILENO, &sequence[1], 1) != 1) return c;
+    // Anything else after an escape is a key of its own
+    if (!editorNextByte(&sequence[0], ESCAPE_TIMEOUT)) return c;
+    if (sequence[0] != '[' && sequence[0] != 'O') {
+      E.input.start--;
+      return c;
+    }
+    if (!editorNextByte(&sequence[1], ESCAPE_TIMEOUT)) return c;
 
     if (sequence[0] == '[') {
       if (sequence[1] >= '0' && sequence[1] <= '9') {
-        if (read(STDIN_FILENO, &sequence[2], 1) != 1) return c;
+        if (!editorNextByte(&sequence[2], ESCAPE_TIMEOUT)) return c;
+
+        // Pasted text comes between "\x1b[200~" and "\x1b[201~"
+        if (sequence[1] == '2' && sequence[2] == '0') {
+          char paste[2];
+
+          if (!editorNextByte(&paste[0], ESCAPE_TIMEOUT)) return c;
+          if (!editorNextByte(&paste[1], ESCAPE_TIMEOUT)) return c;
+
+          if (paste[0] == '0' && paste[1] == '~') return PASTE_START;
+          if (paste[0] == '1' && paste[1] == '~') return PASTE_END;
+          return c;
+        }
 
         if (sequence[2] == '~') {
           switch (sequence[1]) {
@@ -84,6 +220,47 @@ int editorReadKey(void) {
   return c;
 }
 
+// Reads what was pasted after a PASTE_START, up to the sequence closing
+// the paste, copying it out of the input buffer in bulk
+char *editorReadPaste(size_t *length) {
+  static const char end[] = "\x1b[201~";
+  buffer paste = BUFFER_INIT;
+
+  while (true) {
+    if (E.input.start == E.input.end)
+      editorWaitForInput(-1);
+
+    char *from = &E.input.bytes[E.input.start];
+    int available = E.input.end - E.input.start;
+    char *escape = memchr(from, ESC, available);
+    int n = escape ? escape - from : available;
+
+    appendBuffer(&paste, from, n);
+    E.input.start += n;
+
+    if (escape == NULL) continue;
+
+    E.input.start++;
+
+    char c;
+    int matched = 1;
+    bool isRead = false;
+
+    while (matched < 6 && (isRead = editorNextByte(&c, ESCAPE_TIMEOUT)) && c == end[matched])
+      matched++;
+
+    if (matched == 6) break;
+
+    // Only an escape that was part of the text
+    appendBuffer(&paste, end, matched);
+    if (isRead)
+      E.input.start--;
+  }
+
+  *length = paste.length;
+  return paste.content;
+}
+
 bool getCursorPosition(int *rows, int *cols) {
   // Request cursor position (reports as "\x1b[#;#R")
   if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) 
@@ -125,3 +302,33 @@ bool getWindowSize(int *rows, int *cols) {
   }
 }
 
+bool editorUpdateWindowSize(void) {
+  int rows = E.batch.rows, cols = E.batch.cols;
+  if (!E.batch.isRunning && !getWindowSize(&rows, &cols))
+    return false;
+
+  // The last row is kept for the status bar
+  E.screenRows = rows - 1;
+  E.screenCols = cols;
+  return true;
+}
+
+void handleWindowResize(int signal) {
+  (void)signal;
+
+  int saved = errno;
+  write(E.wakeup[1], "r", 1);
+  errno = saved;
+}
+
+// Resizes are picked up by the input loop, away from the signal handler
+void watchWindowSize(void) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handleWindowResize;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+
+  if (sigaction(SIGWINCH, &action, NULL) == -1)
+    die("sigaction");
+}
@@ -1,3 +1,5 @@
+#define _DEFAULT_SOURCE
+
 #include <tools.h>
 
 int min(int a, int b) {
@@ -33,3 +35,14 @@ bool isDark(int r, int g, int b) {
   return lightness < 0.55;
 }
 
+long currentMilliseconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+long currentMicroseconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000L + now.tv_nsec / 1000L;
+}
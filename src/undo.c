@@ -0,0 +1,274 @@
+#include <buffer.h>
+#include <journal.h>
+#include <lines.h>
+#include <output.h>
+#include <pieces.h>
+#include <tools.h>
+#include <undo.h>
+
+// Every change to the text goes through the line functions, which log it
+// here unless the log is suspended. Changes are grouped by the command that
+// made them, so a whole insert or paste goes away with one undo, and typing
+// or deleting along a line keeps growing the same record
+
+void undoInit(void) {
+  E.undo.records = NULL;
+  E.undo.count = E.undo.done = E.undo.capacity = 0;
+  E.undo.saved = 0;
+  E.undo.bytes = 0;
+  E.undo.group = 0;
+  E.undo.isBroken = true;
+  E.undo.isSuspended = false;
+  E.undo.cursorX = E.undo.cursorY = 0;
+}
+
+void undoFreeRecords(int from, int to) {
+  for (int i = from; i < to; i++) {
+    E.undo.bytes -= sizeof(undoRecord) + E.undo.records[i].capacity;
+    free(E.undo.records[i].text);
+  }
+}
+
+void undoClear(void) {
+  undoFreeRecords(0, E.undo.count);
+  free(E.undo.records);
+  undoInit();
+}
+
+// Makes the next change start a group, which undoing it puts the cursor
+// back to where it is now
+void undoBreak(void) {
+  E.undo.isBroken = true;
+  E.undo.cursorX = E.cursorX;
+  E.undo.cursorY = E.cursorY;
+}
+
+void undoReserve(undoRecord *record, size_t length) {
+  if (record->length + length <= record->capacity) return;
+
+  size_t capacity = record->capacity * 2;
+  if (capacity < record->length + length)
+    capacity = record->length + length;
+
+  record->text = realloc(record->text, capacity);
+  E.undo.bytes += capacity - record->capacity;
+  record->capacity = capacity;
+}
+
+// Typing extends the last insert, while deleting forwards or backwards
+// extends the last delete at either end, unless that is where the file was
+// saved
+bool undoMerge(int kind, int row, int col, const char *text, size_t length) {
+  if (E.undo.isBroken || E.undo.done == 0 || E.undo.done == E.undo.saved) return false;
+
+  undoRecord *last = &E.undo.records[E.undo.done - 1];
+  if (last->kind != kind || last->row != row) return false;
+
+  if (kind == UNDO_INSERT_TEXT && (size_t)col == last->col + last->length) {
+    undoReserve(last, length);
+    memcpy(&last->text[last->length], text, length);
+  }
+  else if (kind == UNDO_DELETE_TEXT && col == last->col) {
+    undoReserve(last, length);
+    memcpy(&last->text[last->length], text, length);
+  }
+  else if (kind == UNDO_DELETE_TEXT && col + length == (size_t)last->col) {
+    undoReserve(last, length);
+    memmove(&last->text[length], last->text, last->length);
+    memcpy(last->text, text, length);
+    last->col = col;
+  }
+  else {
+    return false;
+  }
+
+  last->length += length;
+  return true;
+}
+
+// Drops the oldest groups until the log fits in UNDO_MEMORY_LIMIT, always
+// keeping the group being made however big it is. A single change bigger
+// than the limit, such as a huge paste, so goes over it until the next
+// group starts and it can be dropped in turn
+void undoTrim(void) {
+  while (E.undo.bytes > UNDO_MEMORY_LIMIT && E.undo.group > 0) {
+    int end = 1;
+    while (end < E.undo.group && !E.undo.records[end].startsGroup)
+      end++;
+
+    undoFreeRecords(0, end);
+    memmove(E.undo.records, &E.undo.records[end], sizeof(undoRecord) * (E.undo.count - end));
+    E.undo.count -= end;
+    E.undo.done -= end;
+    E.undo.group -= end;
+    if (E.undo.saved != -1)
+      E.undo.saved = E.undo.saved >= end ? E.undo.saved - end : -1;
+  }
+}
+
+void undoPush(int kind, int row, int col, int count, const char *text, size_t length) {
+  if (E.undo.isSuspended) return;
+
+  E.changes++;
+  journalAppend(kind, row, col, count, text, length);
+
+  // Whatever was undone can no longer be redone
+  undoFreeRecords(E.undo.done, E.undo.count);
+  E.undo.count = E.undo.done;
+  if (E.undo.saved > E.undo.done)
+    E.undo.saved = -1;
+
+  if (!undoMerge(kind, row, col, text, length)) {
+    if (E.undo.count == E.undo.capacity) {
+      E.undo.capacity = E.undo.capacity ? E.undo.capacity * 2 : 64;
+      E.undo.records = realloc(E.undo.records, sizeof(undoRecord) * E.undo.capacity);
+    }
+
+    undoRecord *record = &E.undo.records[E.undo.count++];
+    *record = (undoRecord){
+      kind, E.undo.isBroken, row, col, count, -1,
+      E.undo.cursorX, E.undo.cursorY,
+      NULL, 0, 0
+    };
+    E.undo.bytes += sizeof(undoRecord);
+    E.undo.done = E.undo.count;
+    if (record->startsGroup) E.undo.group = E.undo.count - 1;
+
+    undoReserve(record, length);
+    if (length) memcpy(record->text, text, length);
+    record->length = length;
+  }
+
+  E.undo.isBroken = false;
+  undoTrim();
+}
+
+// Logs the deletion of lines [at, at + count) while they are still there,
+// a piece at a time as if each was deleted after the one before. Lines of
+// the original file are logged by where they are in it, and only the
+// others have their text copied
+void undoDeleteLines(int at, int count) {
+  if (E.undo.isSuspended) return;
+
+  buffer text = BUFFER_INIT;
+  int row = at, end = at + count;
+
+  while (row < end) {
+    int offset;
+    linePiece *piece = piecesFind(row, &offset);
+    int run = min(piece->count - offset, end - row);
+
+    if (piece->isOriginal) {
+      undoPush(UNDO_DELETE_LINES, at, 0, run, NULL, 0);
+      E.undo.records[E.undo.done - 1].original = piece->start + offset;
+    }
+    else {
+      text.length = 0;
+      for (int i = 0; i < run; i++) {
+        int length;
+        char *content = editorLineContent(row + i, &length);
+        if (i) appendBuffer(&text, "\n", 1);
+        if (length) appendBuffer(&text, content, length);
+      }
+      undoPush(UNDO_DELETE_LINES, at, 0, run, text.content, text.length);
+    }
+    row += run;
+  }
+
+  freeBuffer(&text);
+}
+
+// Copies the lines deleted straight from the original file into their
+// records, before the file they are read from goes away
+void undoLoadOriginal(void) {
+  for (int i = 0; i < E.undo.count; i++) {
+    undoRecord *record = &E.undo.records[i];
+    if (record->original == -1) continue;
+
+    for (int j = 0; j < record->count; j++) {
+      int length;
+      char *content = originalLineContent(record->original + j, &length);
+
+      undoReserve(record, length + (j > 0));
+      if (j) record->text[record->length++] = LINE_FEED;
+      memcpy(&record->text[record->length], content, length);
+      record->length += length;
+    }
+    record->original = -1;
+  }
+
+  undoTrim();
+}
+
+// Makes the change of a record again, or takes it back
+void undoApply(undoRecord *record, bool isUndo) {
+  bool isInsert = (record->kind == UNDO_INSERT_TEXT || record->kind == UNDO_INSERT_LINES) != isUndo;
+
+  if (record->kind == UNDO_INSERT_TEXT || record->kind == UNDO_DELETE_TEXT) {
+    editorLine *line = editorGetLine(record->row);
+
+    if (isInsert)
+      editorLineInsertString(line, record->col, record->text, record->length);
+    else
+      editorLineDeleteString(line, record->col, record->length);
+  }
+  else if (isInsert && record->original != -1) {
+    editorInsertOriginalLines(record->row, record->original, record->count);
+  }
+  else if (isInsert) {
+    editorInsertLines(record->row, record->text, record->length);
+  }
+  else {
+    editorDeleteLines(record->row, record->count);
+  }
+}
+
+void undoPlaceCursor(int row, int col) {
+  E.cursorY = clamp(0, row, E.numlines - 1);
+  E.cursorX = col;
+  fixCursorXPosition();
+  E.highestLastX = E.cursorX;
+  E.dirty = E.undo.done != E.undo.saved;
+  undoBreak();
+}
+
+void editorUndo(void) {
+  if (E.undo.done == 0) {
+    editorSetStatusMessage("Already at oldest change");
+    return;
+  }
+
+  E.changes++;
+  journalAppend(JOURNAL_UNDO, 0, 0, 0, NULL, 0);
+
+  E.undo.isSuspended = true;
+
+  undoRecord *record;
+  do {
+    record = &E.undo.records[--E.undo.done];
+    undoApply(record, true);
+  } while (!record->startsGroup);
+
+  E.undo.isSuspended = false;
+  undoPlaceCursor(record->cursorY, record->cursorX);
+}
+
+void editorRedo(void) {
+  if (E.undo.done == E.undo.count) {
+    editorSetStatusMessage("Already at newest change");
+    return;
+  }
+
+  E.changes++;
+  journalAppend(JOURNAL_REDO, 0, 0, 0, NULL, 0);
+
+  E.undo.isSuspended = true;
+
+  undoRecord *first = &E.undo.records[E.undo.done];
+  do {
+    undoApply(&E.undo.records[E.undo.done++], false);
+  } while (E.undo.done < E.undo.count && !E.undo.records[E.undo.done].startsGroup);
+
+  E.undo.isSuspended = false;
+  undoPlaceCursor(first->row, first->col);
+}